@@ -219,6 +219,8 @@ struct Param
     uint32_t dwarfVersion;
 
     uint32_t hashThreshold; // MD5 hash symbols larger than this threshold (0 = no hashing)
+    uint32_t parseThreads;  // lex and parse the root modules on this many threads
+    bool ctfeBytecode;  // evaluate simple integer functions with gen.ctfebytecode
 #endif
 };
 
@@ -138,6 +138,9 @@ public:
     void setDocfile();
     bool read(Loc loc); // read file, returns 'true' if succeed, 'false' otherwise.
     Module *parse();       // syntactic parse
+#if IN_LLVM
+    bool parseSource();    // lex and parse only, without inserting the module
+#endif
     void importAll(Scope *sc);
     void semantic(Scope *);    // semantic analysis
     void semantic2(Scope *);   // pass 2 semantic analysis
@@ -193,6 +196,10 @@ public:
     llvm::GlobalVariable* d_cover_valid;  // private immutable size_t[] _d_cover_valid;
     llvm::GlobalVariable* d_cover_data;   // private uint[] _d_cover_data;
     Array<size_t>         d_cover_valid_init; // initializer for _d_cover_valid
+
+    // Set if parseSource() already ran on a worker thread (-parse-threads)
+    bool sourceParsed;
+    bool sourceParseErrors; // result of parseSource()
 #endif
 
     Module *isModule() { return this; }
@@ -24,7 +24,7 @@ struct FileName;
 
 struct File
 {
-    int ref;                    // != 0 if this is a reference to someone else's buffer
+    int ref;                    // != 0 if this is a reference to someone else's buffer, 2 if mapped
     unsigned char *buffer;      // data for our file
     size_t len;                 // amount of data in buffer[]
 
@@ -41,6 +41,10 @@ struct File
      */
 
     bool read();
+#if IN_LLVM
+    bool readOrMap();           // read(), mapping large files
+    void freeBuffer();          // release the buffer if it is owned
+#endif
 
     /* Write file, return true if error
      */
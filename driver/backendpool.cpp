@@ -0,0 +1,221 @@
+//===-- backendpool.cpp ---------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/backendpool.h"
+
+#include "mars.h"
+#include "errors.h"
+#include "driver/targetmachine.h"
+#include "driver/toobj.h"
+#include "gen/irstate.h"
+#include "gen/logger.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/Bitcode/BitcodeWriter.h"
+#else
+#include "llvm/Bitcode/ReaderWriter.h"
+#endif
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/Threading.h"
+#if LDC_LLVM_VER >= 308
+#include "llvm/Support/ThreadPool.h"
+#endif
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+static llvm::cl::opt<unsigned> backendThreads(
+    "j",
+    llvm::cl::desc("Optimize and write up to <N> modules in parallel (0: one "
+                   "per hardware thread, default: 1) (LLVM >= 3.8)"),
+    llvm::cl::value_desc("N"), llvm::cl::init(1), llvm::cl::Prefix,
+    llvm::cl::ZeroOrMore);
+
+static llvm::cl::opt<bool> asyncBackend(
+    "async-backend",
+    llvm::cl::desc("Optimize and write modules on background threads while "
+                   "generating IR for the next module (implied by -j > 1) "
+                   "(LLVM >= 3.8)"),
+    llvm::cl::ZeroOrMore);
+
+static llvm::cl::opt<unsigned> backendQueueDepth(
+    "backend-queue-depth",
+    llvm::cl::desc("Maximum number of generated modules waiting for a "
+                   "background thread (default: one per thread); bounds the "
+                   "memory used by the backend pipeline"),
+    llvm::cl::value_desc("N"), llvm::cl::init(0), llvm::cl::ZeroOrMore);
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsBetween(Clock::time_point start, Clock::time_point end) {
+  return std::chrono::duration<double>(end - start).count();
+}
+
+#if LDC_LLVM_VER >= 308
+/// Worker thread job: materializes the module from its bitcode in a fresh
+/// context and writes it using a private TargetMachine.
+/// Returns false and sets `errorMsg` on failure, to be reported by the main
+/// thread.
+bool writeSerializedModule(const std::string &bitcode,
+                           const std::string &moduleId,
+                           const std::string &filename,
+                           ModuleWriteTimes times,
+                           Clock::time_point submitTime,
+                           std::string &errorMsg) {
+  auto startTime = Clock::now();
+  times.queued = secondsBetween(submitTime, startTime);
+
+  llvm::LLVMContext context;
+#if LDC_LLVM_VER >= 309
+  if (!global.params.output_ll) {
+    context.setDiscardValueNames(true);
+  }
+#endif
+
+  llvm::SMDiagnostic err;
+  std::unique_ptr<llvm::Module> m = llvm::parseIR(
+      llvm::MemoryBufferRef(bitcode, moduleId), err, context);
+  if (!m) {
+    errorMsg = "failed to re-read the LLVM bitcode of module '" + moduleId +
+               "': " + err.getMessage().str();
+    return false;
+  }
+  times.deserialize = secondsBetween(startTime, Clock::now());
+
+  std::unique_ptr<llvm::TargetMachine> target(
+      cloneTargetMachine(*gTargetMachine));
+  // Reuse the serialized module for the IR-to-object cache hash.
+  if (!writeModule(m.get(), filename.c_str(), *target, errorMsg,
+                   global.params.verbose ? &times : nullptr, bitcode)) {
+    return false;
+  }
+
+  if (global.params.verbose) {
+    printModuleWriteTimes(filename.c_str(), times);
+  }
+  return true;
+}
+#endif
+}
+
+namespace ldc {
+
+unsigned getBackendThreadCount() {
+#if LDC_LLVM_VER >= 308
+  // The Logger is not thread-safe, and the external assembler reports errors
+  // itself.
+  if (!llvm::llvm_is_multithreaded() || Logger::enabled() ||
+      shouldAssembleExternally()) {
+    return 0;
+  }
+
+  unsigned numThreads = backendThreads;
+  if (numThreads == 0) {
+    numThreads = std::thread::hardware_concurrency();
+  }
+  if (numThreads > 1) {
+    return numThreads;
+  }
+  return asyncBackend ? 1 : 0;
+#else
+  return 0;
+#endif
+}
+
+#if LDC_LLVM_VER >= 308
+BackendPool::BackendPool(unsigned numThreads)
+    : pool_(new llvm::ThreadPool(numThreads)),
+      maxPending_(numThreads +
+                  (backendQueueDepth ? backendQueueDepth : numThreads)),
+      numPending_(0), failed_(false) {}
+#else
+BackendPool::BackendPool(unsigned numThreads) {
+  llvm_unreachable("Parallel object emission requires LLVM >= 3.8");
+}
+#endif
+
+BackendPool::~BackendPool() { wait(); }
+
+void BackendPool::submit(llvm::Module &m, const char *filename) {
+#if LDC_LLVM_VER >= 308
+  // Stop at the first failed module (but only after joining the threads).
+  bool failed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed = failed_;
+  }
+  if (failed) {
+    wait();
+  }
+
+  ModuleWriteTimes times;
+
+  // Block until there is a free slot in the queue, bounding the number of
+  // modules held in memory.
+  auto startTime = Clock::now();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    slotFreed_.wait(lock, [this] { return numPending_ < maxPending_; });
+    ++numPending_;
+  }
+  auto serializeStart = Clock::now();
+  times.stall = secondsBetween(startTime, serializeStart);
+
+  std::string bitcode;
+  {
+    llvm::raw_string_ostream os(bitcode);
+    llvm::WriteBitcodeToFile(&m, os);
+  }
+  auto submitTime = Clock::now();
+  times.serialize = secondsBetween(serializeStart, submitTime);
+
+  pool_->async(
+      [this](const std::string &bitcode, const std::string &moduleId,
+             const std::string &filename, const ModuleWriteTimes &times,
+             Clock::time_point submitTime) {
+        std::string errorMsg;
+        const bool success = writeSerializedModule(
+            bitcode, moduleId, filename, times, submitTime, errorMsg);
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          --numPending_;
+          if (!success) {
+            errorMessages_.push_back(std::move(errorMsg));
+            failed_ = true;
+          }
+        }
+        slotFreed_.notify_one();
+      },
+      std::move(bitcode), m.getModuleIdentifier(), std::string(filename),
+      times, submitTime);
+#endif
+}
+
+void BackendPool::wait() {
+#if LDC_LLVM_VER >= 308
+  pool_->wait();
+
+  // All jobs are finished, so the errors can be reported now.
+  if (failed_) {
+    for (const auto &errorMsg : errorMessages_) {
+      error(Loc(), "%s", errorMsg.c_str());
+    }
+    fatal();
+  }
+#endif
+}
+}
@@ -0,0 +1,78 @@
+//===-- driver/backendpool.h - Parallel object emission ---------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Contains ldc::BackendPool, which runs the optimization and output emission
+// phase of finished LLVM modules (see writeModule()) on a pool of worker
+// threads, while the main thread goes on generating IR for the next module.
+//
+// IR generation itself stays single-threaded, as the frontend and the IR type
+// caches are bound to the global LLVMContext. Each finished module is thus
+// serialized to bitcode and re-materialized in a fresh, per-job LLVMContext on
+// the worker thread, which also uses its own TargetMachine.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_BACKENDPOOL_H
+#define LDC_DRIVER_BACKENDPOOL_H
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Module;
+class ThreadPool;
+}
+
+namespace ldc {
+
+/// Returns the number of backend threads to use, as requested via `-j` and
+/// `-async-backend`. Returns 0 if modules are to be written synchronously by
+/// the calling thread.
+unsigned getBackendThreadCount();
+
+/// Pipeline of worker threads optimizing and writing finished modules.
+///
+/// At most (number of threads + `-backend-queue-depth`) modules are in flight
+/// at any time; submit() blocks until a slot becomes available, so that the
+/// memory used by serialized modules stays bounded.
+///
+/// The jobs don't report errors themselves, as the frontend's diagnostics
+/// aren't thread-safe. Failures are reported by the calling thread once all
+/// jobs have finished, in wait() or in the next submit(), and are fatal.
+class BackendPool {
+public:
+  explicit BackendPool(unsigned numThreads);
+  /// Waits for all pending jobs.
+  ~BackendPool();
+
+  /// Schedules optimization and emission of the given module to `filename`.
+  /// The module is serialized right away and may be freed after this call.
+  void submit(llvm::Module &m, const char *filename);
+
+  /// Blocks until all submitted modules have been written, and reports the
+  /// errors of failed jobs, if any.
+  void wait();
+
+private:
+#if LDC_LLVM_VER >= 308
+  std::unique_ptr<llvm::ThreadPool> pool_;
+  unsigned const maxPending_;
+  unsigned numPending_; // queued or running jobs, guarded by mutex_
+  std::vector<std::string> errorMessages_; // guarded by mutex_
+  bool failed_;                            // guarded by mutex_
+  std::mutex mutex_;
+  std::condition_variable slotFreed_;
+#endif
+};
+}
+
+#endif
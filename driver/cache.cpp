@@ -25,14 +25,36 @@
 // The hash depends on the IR code (obviously), but also on the compiler+LLVM
 // versions and several compile flags (e.g. -O*, -mcpu, and -mattr).
 //
+// Cache files are stored in subdirectories named after the first two hex
+// digits of their hash, to keep directory lookups fast for large caches. Each
+// insertion and each cache hit appends a line "<time> <size> <path>" to the
+// index file in the cache directory, from which the pruning algorithm learns
+// the size and last access time of the files without scanning the cache.
+//
+// For (Thin)LTO builds, the cached "object file" is the optimized bitcode file
+// (including the ThinLTO module summary) that is handed to the linker, so
+// that the IR optimization is skipped on a cache hit.
+//
+// With -cache-frontend, a second cache tier is consulted before parsing: for
+// each root module, a manifest file maps a hash of all root sources, the
+// predefined versions and the compile flags to the IR hash of the module's
+// cached object file, and lists the hashes of all files imported during the
+// compilation that produced it. If the manifests of all root modules match
+// and the dependencies are unchanged, the object files are recovered right
+// away and semantic analysis and IR codegen are skipped entirely.
+//
 //===----------------------------------------------------------------------===//
 
 #include "driver/cache.h"
 
+#include "driver/cache_backend.h"
 #include "ddmd/errors.h"
+#include "ddmd/module.h"
+#include "rmem.h"
 #include "driver/cache_pruning.h"
 #include "driver/cl_options.h"
 #include "driver/ldc-version.h"
+#include "driver/timetrace.h"
 #include "gen/logger.h"
 #include "gen/optimizer.h"
 
@@ -43,10 +65,19 @@
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Support/TimeValue.h"
 #endif
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/FileSystem.h"
-#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 // Include close() declaration.
 #if !defined(_MSC_VER) && !defined(__MINGW32__)
@@ -56,17 +87,49 @@
 #endif
 
 #if LDC_POSIX
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
 // Returns true upon error.
 static bool createHardLink(const char *to, const char *from) {
   return link(to, from) == -1;
 }
+// Creates `from` as copy-on-write clone of `to`, if supported by the file
+// system (e.g. Btrfs, XFS). Returns true upon error.
+static bool createReflink(const char *to, const char *from) {
+#if defined(__linux__)
+  const int src = open(to, O_RDONLY);
+  if (src < 0)
+    return true;
+  const int dst = open(from, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (dst < 0) {
+    close(src);
+    return true;
+  }
+  const bool failed = ioctl(dst, FICLONE, src) != 0;
+  close(dst);
+  close(src);
+  if (failed)
+    unlink(from);
+  return failed;
+#else
+  return true;
+#endif
+}
 // Returns true upon error.
 static bool createSymLink(const char *to, const char *from) {
   return symlink(to, from) == -1;
 }
 #elif _WIN32
 #include <windows.h>
+// Returns true upon error.
+static bool createReflink(const char *to, const char *from) { return true; }
 namespace llvm {
 namespace sys {
 namespace path {
@@ -140,14 +203,18 @@ llvm::cl::opt<unsigned> pruneSizeLimitPercentage(
         "space (default: 75%). Implies -cache-prune."),
     llvm::cl::value_desc("perc"), llvm::cl::init(75));
 
-enum class RetrievalMode { Copy, HardLink, AnyLink, SymLink };
+enum class RetrievalMode { Auto, Copy, HardLink, AnyLink, SymLink };
 llvm::cl::opt<RetrievalMode> cacheRecoveryMode(
     "cache-retrieval",
-    llvm::cl::desc("Set the cache retrieval mechanism (default: copy)."),
-    llvm::cl::init(RetrievalMode::Copy),
+    llvm::cl::desc("Set the cache retrieval mechanism (default: auto)."),
+    llvm::cl::init(RetrievalMode::Auto),
     clEnumValues(
+        clEnumValN(RetrievalMode::Auto, "auto",
+                   "Create a hard link to the cache file, or a copy if the "
+                   "cache is on another device"),
         clEnumValN(RetrievalMode::Copy, "copy",
-                   "Make a copy of the cache file"),
+                   "Make a copy of the cache file (a copy-on-write clone if "
+                   "supported by the file system)"),
         clEnumValN(RetrievalMode::HardLink, "hardlink",
                    "Create a hard link to the cache file (recommended)"),
         clEnumValN(
@@ -156,6 +223,21 @@ llvm::cl::opt<RetrievalMode> cacheRecoveryMode(
         clEnumValN(RetrievalMode::SymLink, "symlink",
                    "Create a symbolic link to the cache file")));
 
+llvm::cl::opt<std::string> cacheDaemon(
+    "cache-daemon",
+    llvm::cl::desc("Store and look up cached object files through the cache "
+                   "daemon (ldc-cache-daemon) listening on the Unix domain "
+                   "socket <path>, instead of the -cache directory."),
+    llvm::cl::value_desc("path"), llvm::cl::ZeroOrMore);
+
+llvm::cl::opt<bool> cacheFrontend(
+    "cache-frontend",
+    llvm::cl::desc("Look up the object files in the cache before parsing, "
+                   "based on the source files and all imported files, and skip "
+                   "semantic analysis and codegen if all are found (requires "
+                   "-cache)."),
+    llvm::cl::ZeroOrMore);
+
 bool isPruningEnabled() {
   if (pruneEnabled)
     return true;
@@ -179,16 +261,139 @@ llvm::sys::TimePoint<std::chrono::seconds> getTimeNow() {
 llvm::sys::TimeValue getTimeNow() { return llvm::sys::TimeValue::now(); }
 #endif
 
+/// Resets the modification and access time of a cache file to "now".
+bool touchCacheFile(const char *cacheFile, std::string &errorMsg) {
+  int FD;
+  if (llvm::sys::fs::openFileForWrite(cacheFile, FD,
+                                      llvm::sys::fs::F_Append)) {
+    errorMsg = std::string("Failed to open the cached file for writing: ") +
+               cacheFile;
+    return false;
+  }
+
+  const bool failed =
+      !!llvm::sys::fs::setLastModificationAndAccessTime(FD, getTimeNow());
+  close(FD);
+  if (failed) {
+    errorMsg =
+        std::string("Failed to set the cached file modification time: ") +
+        cacheFile;
+    return false;
+  }
+  return true;
+}
+
+/// Streaming implementation of the 64-bit xxHash algorithm
+/// (https://github.com/Cyan4973/xxHash), which is several times faster than
+/// MD5 on the large bitcode buffers hashed for the cache.
+class XXHash64 {
+  static constexpr uint64_t Prime1 = 11400714785074694791ULL;
+  static constexpr uint64_t Prime2 = 14029467366897019727ULL;
+  static constexpr uint64_t Prime3 = 1609587929392839161ULL;
+  static constexpr uint64_t Prime4 = 9650029242287828579ULL;
+  static constexpr uint64_t Prime5 = 2870177450012600261ULL;
+
+  uint64_t seed;
+  uint64_t acc[4];
+  uint64_t totalLength = 0;
+  uint8_t stripe[32]; // buffered input not yet forming a complete stripe
+  size_t stripeSize = 0;
+
+  static uint64_t rotl(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+  }
+  static uint64_t read64(const uint8_t *p) {
+    return llvm::support::endian::read64le(p);
+  }
+  static uint64_t round(uint64_t acc, uint64_t input) {
+    return rotl(acc + input * Prime2, 31) * Prime1;
+  }
+  static uint64_t mergeRound(uint64_t acc, uint64_t val) {
+    return (acc ^ round(0, val)) * Prime1 + Prime4;
+  }
+
+  void consumeStripe(const uint8_t *p) {
+    for (unsigned i = 0; i < 4; ++i)
+      acc[i] = round(acc[i], read64(p + 8 * i));
+  }
+
+public:
+  explicit XXHash64(uint64_t seed) : seed(seed) {
+    acc[0] = seed + Prime1 + Prime2;
+    acc[1] = seed + Prime2;
+    acc[2] = seed;
+    acc[3] = seed - Prime1;
+  }
+
+  void update(const uint8_t *data, size_t size) {
+    totalLength += size;
+
+    if (stripeSize + size < 32) {
+      memcpy(stripe + stripeSize, data, size);
+      stripeSize += size;
+      return;
+    }
+
+    if (stripeSize) {
+      const size_t fill = 32 - stripeSize;
+      memcpy(stripe + stripeSize, data, fill);
+      consumeStripe(stripe);
+      data += fill;
+      size -= fill;
+      stripeSize = 0;
+    }
+
+    for (; size >= 32; data += 32, size -= 32)
+      consumeStripe(data);
+
+    memcpy(stripe, data, size);
+    stripeSize = size;
+  }
+
+  uint64_t final() const {
+    uint64_t h;
+    if (totalLength >= 32) {
+      h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) +
+          rotl(acc[3], 18);
+      for (unsigned i = 0; i < 4; ++i)
+        h = mergeRound(h, acc[i]);
+    } else {
+      h = seed + Prime5;
+    }
+    h += totalLength;
+
+    const uint8_t *p = stripe;
+    const uint8_t *const end = stripe + stripeSize;
+    for (; p + 8 <= end; p += 8)
+      h = rotl(h ^ round(0, read64(p)), 27) * Prime1 + Prime4;
+    if (p + 4 <= end) {
+      h ^= uint64_t(llvm::support::endian::read32le(p)) * Prime1;
+      h = rotl(h, 23) * Prime2 + Prime3;
+      p += 4;
+    }
+    for (; p < end; ++p)
+      h = rotl(h ^ (*p * Prime5), 11) * Prime1;
+
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+  }
+};
+
 /// A raw_ostream that creates a hash of what is written to it.
 /// This class does not encounter output errors.
 /// There is no buffering and the hasher can be used at any time.
+/// The 128-bit hash consists of two differently seeded 64-bit xxHash lanes.
 class raw_hash_ostream : public llvm::raw_ostream {
-  llvm::MD5 hasher;
+  XXHash64 lanes[2] = {XXHash64(0), XXHash64(0x9E3779B97F4A7C15ULL)};
 
   /// See raw_ostream::write_impl.
   void write_impl(const char *ptr, size_t size) override {
-    hasher.update(
-        llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(ptr), size));
+    for (auto &lane : lanes)
+      lane.update(reinterpret_cast<const uint8_t *>(ptr), size);
   }
 
   uint64_t current_pos() const override { return 0; }
@@ -199,19 +404,123 @@ public:
 
   void flush() = delete;
 
-  void finalResult(llvm::MD5::MD5Result &result) { hasher.final(result); }
   void resultAsString(llvm::SmallString<32> &str) {
-    llvm::MD5::MD5Result result;
-    hasher.final(result);
-    llvm::MD5::stringifyResult(result, str);
+    char buffer[33];
+    snprintf(buffer, sizeof(buffer), "%016llx%016llx",
+             static_cast<unsigned long long>(lanes[0].final()),
+             static_cast<unsigned long long>(lanes[1].final()));
+    str = buffer;
   }
 };
 
 void storeCacheFileName(llvm::StringRef cacheObjectHash,
                         llvm::SmallString<128> &filePath) {
   filePath = opts::cacheDir;
-  llvm::sys::path::append(filePath, llvm::Twine("ircache_") + cacheObjectHash +
-                                        "." + global.obj_ext);
+  llvm::sys::path::append(filePath, cacheObjectHash.substr(0, 2),
+                          llvm::Twine("ircache_") + cacheObjectHash + "." +
+                              global.obj_ext);
+}
+
+/// Creates the (sharded) directory of a cache file, and returns the name of a
+/// unique temporary file from which the cache file can be added atomically.
+/// Temporary files live in the cache root, where the pruning algorithm looks
+/// for remnants of aborted compilations.
+bool prepareCacheFile(llvm::StringRef cacheFile,
+                      llvm::SmallString<128> &tempFile,
+                      std::string &errorMsg) {
+  const auto directory = llvm::sys::path::parent_path(cacheFile);
+  if (llvm::sys::fs::create_directories(directory)) {
+    errorMsg = ("Unable to create cache directory: " + directory).str();
+    return false;
+  }
+
+  llvm::SmallString<128> model(opts::cacheDir);
+  llvm::sys::path::append(model, llvm::sys::path::filename(cacheFile) +
+                                     ".tmp%%%%%%%");
+  if (llvm::sys::fs::createUniqueFile(model, tempFile)) {
+    errorMsg = "Could not create name of temporary file in the cache.";
+    return false;
+  }
+  return true;
+}
+
+/// Appends the current size and access time of `cacheFile` to the cache
+/// index. Lines are written with a single append, so that concurrent
+/// compiler invocations don't garble the index.
+void addToCacheIndex(llvm::StringRef cacheFile) {
+  uint64_t size;
+  if (llvm::sys::fs::file_size(cacheFile, size))
+    return;
+
+  llvm::SmallString<128> indexFile(opts::cacheDir);
+  llvm::sys::path::append(indexFile, "ircache_index");
+
+  const auto now = std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::system_clock::now().time_since_epoch());
+  // Cache files are stored in a shard directory of the cache root. (The path
+  // isn't derived from opts::cacheDir, which may end with a separator.)
+  const std::string line =
+      (llvm::Twine(now.count()) + " " + llvm::Twine(size) + " " +
+       llvm::sys::path::filename(llvm::sys::path::parent_path(cacheFile)) +
+       "/" + llvm::sys::path::filename(cacheFile) + "\n")
+          .str();
+
+#if LDC_POSIX
+  // The pruning algorithm replaces the index by a compacted one while holding
+  // an exclusive lock on it (see driver/cache_pruning.d). Append only while
+  // holding a shared lock on the current index file, so that the record isn't
+  // lost.
+  for (int attempt = 0; attempt < 10; ++attempt) {
+    const int FD = open(indexFile.c_str(), O_RDWR | O_APPEND | O_CREAT, 0666);
+    if (FD < 0)
+      break;
+    struct flock lock = {};
+    lock.l_type = F_RDLCK;
+    lock.l_whence = SEEK_SET;
+    bool replaced = false;
+    if (fcntl(FD, F_SETLKW, &lock) == 0) {
+      struct stat opened, current;
+      replaced = fstat(FD, &opened) != 0 ||
+                 stat(indexFile.c_str(), &current) != 0 ||
+                 opened.st_dev != current.st_dev ||
+                 opened.st_ino != current.st_ino;
+    }
+    // Without locking support, append anyway.
+    if (!replaced) {
+      llvm::raw_fd_ostream os(FD, /*shouldClose=*/true, /*unbuffered=*/true);
+      os << line;
+      return;
+    }
+    close(FD);
+  }
+  IF_LOG Logger::println("Failed to open the cache index: %s",
+                         indexFile.c_str());
+#else
+  int FD;
+  if (llvm::sys::fs::openFileForWrite(indexFile, FD,
+                                      llvm::sys::fs::F_Append)) {
+    IF_LOG Logger::println("Failed to open the cache index: %s",
+                           indexFile.c_str());
+    return;
+  }
+  llvm::raw_fd_ostream os(FD, /*shouldClose=*/true, /*unbuffered=*/true);
+  os << line;
+#endif
+}
+
+// Returns true for `arg` being one of the options that only affect how the
+// compiler schedules its work or which reports it writes, not its output.
+bool isOutputIrrelevantArg(const char *arg) {
+  // "-j...", "-async-backend" and "-backend-queue-depth..." only affect how
+  // modules are scheduled for writing, "-parse-threads..." how they are
+  // parsed.
+  if (arg[1] == 'j' || strcmp(arg + 1, "async-backend") == 0 ||
+      strncmp(arg + 1, "backend-queue-depth", 19) == 0 ||
+      strncmp(arg + 1, "parse-threads", 13) == 0)
+    return true;
+  // "-ftime-trace..." and "-dgc2stack-report..." write reports.
+  return strncmp(arg + 1, "ftime-trace", 11) == 0 ||
+         strncmp(arg + 1, "dgc2stack-report", 16) == 0;
 }
 
 // Output to `hash_os` all commandline flags, and try to skip the ones that have
@@ -272,6 +581,8 @@ void outputIR2ObjRelevantCmdlineArgs(llvm::raw_ostream &hash_os)
       // "-od..." can be ignored
       if (arg[1] == 'o' && arg[2] == 'd')
         continue;
+      if (isOutputIrrelevantArg(arg))
+        continue;
       // All  "-cache..." options can be ignored
       if (strncmp(arg+1, "cache", 5) == 0)
         continue;
@@ -324,7 +635,9 @@ void outputIR2ObjRelevantEnvironmentOpts(llvm::raw_ostream &hash_os)
 
 namespace cache {
 
-void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str) {
+namespace {
+void calculateModuleHash(llvm::Module *m, llvm::StringRef moduleBitcode,
+                         llvm::SmallString<32> &str) {
   raw_hash_ostream hash_os;
 
   // Let hash depend on the compiler version:
@@ -337,15 +650,45 @@ void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str) {
   outputIR2ObjRelevantCmdlineArgs(hash_os);
   outputIR2ObjRelevantEnvironmentOpts(hash_os);
 
-  llvm::WriteBitcodeToFile(m, hash_os);
+  if (m) {
+    llvm::WriteBitcodeToFile(m, hash_os);
+  } else {
+    hash_os << moduleBitcode;
+  }
   hash_os.resultAsString(str);
   IF_LOG Logger::println("Module's LLVM bitcode hash is: %s", str.c_str());
 }
+}
 
-std::string cacheLookup(llvm::StringRef cacheObjectHash) {
-  if (opts::cacheDir.empty())
-    return "";
+void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str) {
+  calculateModuleHash(m, llvm::StringRef(), str);
+}
+
+void calculateModuleHash(llvm::StringRef moduleBitcode,
+                         llvm::SmallString<32> &str) {
+  calculateModuleHash(nullptr, moduleBitcode, str);
+}
+
+namespace {
 
+/// The cache directory, see the top of this file.
+class DirectoryCacheBackend : public CacheBackend {
+public:
+  std::string location() const override { return opts::cacheDir; }
+  std::string lookup(llvm::StringRef cacheObjectHash) override;
+  bool store(llvm::StringRef objectFile, llvm::StringRef cacheObjectHash,
+             std::string &errorMsg) override;
+  bool recover(llvm::StringRef cacheObjectHash, llvm::StringRef objectFile,
+               std::string &errorMsg) override;
+  std::string createTempObjectFile(llvm::StringRef cacheObjectHash,
+                                   std::string &errorMsg) override;
+  bool commitObjectFile(llvm::StringRef tempFile,
+                        llvm::StringRef cacheObjectHash,
+                        llvm::StringRef objectFile,
+                        std::string &errorMsg) override;
+};
+
+std::string DirectoryCacheBackend::lookup(llvm::StringRef cacheObjectHash) {
   if (!llvm::sys::fs::exists(opts::cacheDir)) {
     IF_LOG Logger::println("Cache directory does not exist, no object found.");
     return "";
@@ -362,16 +705,13 @@ std::string cacheLookup(llvm::StringRef cacheObjectHash) {
   return "";
 }
 
-void cacheObjectFile(llvm::StringRef objectFile,
-                     llvm::StringRef cacheObjectHash) {
-  if (opts::cacheDir.empty())
-    return;
-
+bool DirectoryCacheBackend::store(llvm::StringRef objectFile,
+                                  llvm::StringRef cacheObjectHash,
+                                  std::string &errorMsg) {
   if (!llvm::sys::fs::exists(opts::cacheDir) &&
       llvm::sys::fs::create_directories(opts::cacheDir)) {
-    error(Loc(), "Unable to create cache directory: %s",
-          opts::cacheDir.c_str());
-    fatal();
+    errorMsg = "Unable to create cache directory: " + opts::cacheDir;
+    return false;
   }
 
   // To prevent bad cache files, add files to the cache atomically: first copy
@@ -382,105 +722,551 @@ void cacheObjectFile(llvm::StringRef objectFile,
   storeCacheFileName(cacheObjectHash, cacheFile);
 
   llvm::SmallString<128> tempFile;
-  if (llvm::sys::fs::createUniqueFile(llvm::Twine(cacheFile) + ".tmp%%%%%%%",
-                                      tempFile)) {
-    error(Loc(), "Could not create name of temporary file in the cache.");
-    fatal();
-  }
+  if (!prepareCacheFile(cacheFile, tempFile, errorMsg))
+    return false;
 
   IF_LOG Logger::println("Copy object file to temp file: %s to %s",
                          objectFile.str().c_str(), tempFile.c_str());
   if (llvm::sys::fs::copy_file(objectFile, tempFile.c_str())) {
-    error(Loc(), "Failed to copy object file to cache: %s to %s",
-          objectFile.str().c_str(), tempFile.c_str());
-    fatal();
+    errorMsg = ("Failed to copy object file to cache: " + objectFile + " to " +
+                tempFile)
+                   .str();
+    return false;
   }
   IF_LOG Logger::println("Rename temp file to cache file: %s to %s",
                          tempFile.c_str(), cacheFile.c_str());
   if (llvm::sys::fs::rename(tempFile.c_str(), cacheFile.c_str())) {
-    error(Loc(), "Failed to rename temp file to cache file: %s to %s",
-          tempFile.c_str(), cacheFile.c_str());
-    fatal();
+    errorMsg = ("Failed to rename temp file to cache file: " + tempFile +
+                " to " + cacheFile)
+                   .str();
+    return false;
   }
+  addToCacheIndex(cacheFile);
+  return true;
 }
 
-void recoverObjectFile(llvm::StringRef cacheObjectHash,
-                       llvm::StringRef objectFile) {
-  llvm::SmallString<128> cacheFile;
-  storeCacheFileName(cacheObjectHash, cacheFile);
+/// Copies `cacheFile` to `objectFile`, as copy-on-write clone if the file
+/// system supports it.
+bool copyCacheFile(llvm::StringRef cacheFile, llvm::StringRef objectFile,
+                   std::string &errorMsg) {
+  if (!createReflink(cacheFile.str().c_str(), objectFile.str().c_str())) {
+    IF_LOG Logger::println("Reflink cached object file: %s -> %s",
+                           cacheFile.str().c_str(), objectFile.str().c_str());
+    return true;
+  }
+  IF_LOG Logger::println("Copy cached object file: %s -> %s",
+                         cacheFile.str().c_str(), objectFile.str().c_str());
+  if (llvm::sys::fs::copy_file(cacheFile, objectFile)) {
+    errorMsg = ("Failed to copy the cached file: " + cacheFile + " -> " +
+                objectFile)
+                   .str();
+    return false;
+  }
+  return true;
+}
 
+/// Creates `objectFile` from `cacheFile`, as requested by -cache-retrieval.
+/// Hard links share the data with the cache file, so writeModule() removes
+/// existing object files instead of overwriting them.
+bool retrieveCacheFile(llvm::StringRef cacheFile, llvm::StringRef objectFile,
+                       std::string &errorMsg) {
   // Remove the potentially pre-existing output file.
   llvm::sys::fs::remove(objectFile);
 
   switch (cacheRecoveryMode) {
-  case RetrievalMode::Copy: {
-    IF_LOG Logger::println("Copy cached object file: %s -> %s",
-                           cacheFile.c_str(), objectFile.str().c_str());
-    if (llvm::sys::fs::copy_file(cacheFile.c_str(), objectFile)) {
-      error(Loc(), "Failed to copy the cached file: %s -> %s",
-            cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
+  case RetrievalMode::Auto: {
+    // Hard links are only possible on the same device (and file system).
+    if (!createHardLink(cacheFile.str().c_str(), objectFile.str().c_str())) {
+      IF_LOG Logger::println("HardLink output to cached object file: %s -> %s",
+                             objectFile.str().c_str(),
+                             cacheFile.str().c_str());
+      break;
     }
+    if (!copyCacheFile(cacheFile, objectFile, errorMsg))
+      return false;
+  } break;
+  case RetrievalMode::Copy: {
+    if (!copyCacheFile(cacheFile, objectFile, errorMsg))
+      return false;
   } break;
   case RetrievalMode::HardLink: {
     IF_LOG Logger::println("HardLink output to cached object file: %s -> %s",
-                           objectFile.str().c_str(), cacheFile.c_str());
-    if (createHardLink(cacheFile.c_str(), objectFile.str().c_str())) {
-      error(Loc(), "Failed to create a hard link to the cached file: %s -> %s",
-            cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
+                           objectFile.str().c_str(), cacheFile.str().c_str());
+    if (createHardLink(cacheFile.str().c_str(), objectFile.str().c_str())) {
+      errorMsg = ("Failed to create a hard link to the cached file: " +
+                  cacheFile + " -> " + objectFile)
+                     .str();
+      return false;
     }
   } break;
   case RetrievalMode::AnyLink: {
     IF_LOG Logger::println("Link output to cached object file: %s -> %s",
-                           objectFile.str().c_str(), cacheFile.c_str());
-    if (llvm::sys::fs::create_link(cacheFile.c_str(), objectFile)) {
-      error(Loc(), "Failed to create a link to the cached file: %s -> %s",
-            cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
+                           objectFile.str().c_str(), cacheFile.str().c_str());
+    if (llvm::sys::fs::create_link(cacheFile, objectFile)) {
+      errorMsg = ("Failed to create a link to the cached file: " + cacheFile +
+                  " -> " + objectFile)
+                     .str();
+      return false;
     }
   } break;
   case RetrievalMode::SymLink: {
     IF_LOG Logger::println("SymLink output to cached object file: %s -> %s",
-                           objectFile.str().c_str(), cacheFile.c_str());
-    if (createSymLink(cacheFile.c_str(), objectFile.str().c_str())) {
-      error(Loc(),
-            "Failed to create a symbolic link to the cached file: %s -> %s",
-            cacheFile.c_str(), objectFile.str().c_str());
-      fatal();
+                           objectFile.str().c_str(), cacheFile.str().c_str());
+    if (createSymLink(cacheFile.str().c_str(), objectFile.str().c_str())) {
+      errorMsg = ("Failed to create a symbolic link to the cached file: " +
+                  cacheFile + " -> " + objectFile)
+                     .str();
+      return false;
     }
   } break;
   }
+  return true;
+}
+
+bool DirectoryCacheBackend::recover(llvm::StringRef cacheObjectHash,
+                                    llvm::StringRef objectFile,
+                                    std::string &errorMsg) {
+  llvm::SmallString<128> cacheFile;
+  storeCacheFileName(cacheObjectHash, cacheFile);
+
+  if (!retrieveCacheFile(cacheFile, objectFile, errorMsg))
+    return false;
 
   // We reset the modification time to "now" such that the pruning algorithm
   // sees that the file should be kept over older files.
   // On some systems the last accessed time is not automatically updated so set
   // it explicitly here. Because the file will really only be accessed later
   // during linking, it's not perfect but it's the best we can do.
-  {
-    int FD;
-    if (llvm::sys::fs::openFileForWrite(cacheFile.c_str(), FD,
-                                        llvm::sys::fs::F_Append)) {
-      error(Loc(), "Failed to open the cached file for writing: %s",
-            cacheFile.c_str());
-      fatal();
-    }
+  if (!touchCacheFile(cacheFile.c_str(), errorMsg))
+    return false;
+  addToCacheIndex(cacheFile);
+  return true;
+}
 
-    if (llvm::sys::fs::setLastModificationAndAccessTime(FD, getTimeNow())) {
-      error(Loc(), "Failed to set the cached file modification time: %s",
-            cacheFile.c_str());
-      fatal();
-    }
+std::string
+DirectoryCacheBackend::createTempObjectFile(llvm::StringRef cacheObjectHash,
+                                            std::string &errorMsg) {
+  llvm::SmallString<128> cacheFile;
+  storeCacheFileName(cacheObjectHash, cacheFile);
 
-    close(FD);
+  llvm::SmallString<128> tempFile;
+  if (!prepareCacheFile(cacheFile, tempFile, errorMsg))
+    return "";
+  return tempFile.str().str();
+}
+
+bool DirectoryCacheBackend::commitObjectFile(llvm::StringRef tempFile,
+                                             llvm::StringRef cacheObjectHash,
+                                             llvm::StringRef objectFile,
+                                             std::string &errorMsg) {
+  llvm::SmallString<128> cacheFile;
+  storeCacheFileName(cacheObjectHash, cacheFile);
+
+  IF_LOG Logger::println("Rename temp file to cache file: %s to %s",
+                         tempFile.str().c_str(), cacheFile.c_str());
+  if (llvm::sys::fs::rename(tempFile, cacheFile.c_str())) {
+    errorMsg = ("Failed to rename temp file to cache file: " + tempFile +
+                " to " + cacheFile)
+                   .str();
+    return false;
   }
+  addToCacheIndex(cacheFile);
+
+  return retrieveCacheFile(cacheFile, objectFile, errorMsg);
+}
+
+CacheBackend &getBackend() {
+  static std::unique_ptr<CacheBackend> backend(
+      cacheDaemon.empty() ? new DirectoryCacheBackend()
+                          : createDaemonCacheBackend(cacheDaemon).release());
+  return *backend;
+}
+} // anonymous namespace
+
+bool isEnabled() { return !opts::cacheDir.empty() || !cacheDaemon.empty(); }
+
+std::string cacheLocation() { return getBackend().location(); }
+
+std::string cacheLookup(llvm::StringRef cacheObjectHash) {
+  if (!isEnabled())
+    return "";
+  return getBackend().lookup(cacheObjectHash);
+}
+
+bool cacheObjectFile(llvm::StringRef objectFile,
+                     llvm::StringRef cacheObjectHash, std::string &errorMsg) {
+  if (!isEnabled())
+    return true;
+  return getBackend().store(objectFile, cacheObjectHash, errorMsg);
+}
+
+bool recoverObjectFile(llvm::StringRef cacheObjectHash,
+                       llvm::StringRef objectFile, std::string &errorMsg) {
+  return getBackend().recover(cacheObjectHash, objectFile, errorMsg);
+}
+
+std::string createTempObjectFile(llvm::StringRef cacheObjectHash,
+                                 std::string &errorMsg) {
+  if (!isEnabled())
+    return "";
+  return getBackend().createTempObjectFile(cacheObjectHash, errorMsg);
+}
+
+bool commitObjectFile(llvm::StringRef tempFile,
+                      llvm::StringRef cacheObjectHash,
+                      llvm::StringRef objectFile, std::string &errorMsg) {
+  return getBackend().commitObjectFile(tempFile, cacheObjectHash, objectFile,
+                                       errorMsg);
 }
 
 void pruneCache() {
-  if (!opts::cacheDir.empty() && isPruningEnabled()) {
+  if (opts::cacheDir.empty()) {
+    return;
+  }
+  if (isPruningEnabled()) {
     ::pruneCache(opts::cacheDir.data(), opts::cacheDir.size(),
                  pruneInterval, pruneExpiration, pruneSizeLimitInBytes,
                  pruneSizeLimitPercentage);
+  } else {
+    // The index gets a record for each cache hit.
+    ::compactCacheIndex(opts::cacheDir.data(), opts::cacheDir.size());
+  }
+}
+} // namespace cache
+
+//===----------------------------------------------------------------------===//
+// Frontend cache
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+// Set by recoverFromFrontendCache().
+bool frontendCacheEnabled = false;
+bool frontendCacheRecovered = false;
+bool frontendCacheUncacheable = false;
+size_t numInitialLinkSwitches = 0;
+/// The manifest key of each root module.
+std::vector<std::pair<Module *, std::string>> frontendCacheKeys;
+/// The imported modules and files read via string imports (`import("file")`),
+/// in the order they were read, each with the hash of the contents seen by the
+/// frontend (empty if they may not be cached).
+std::vector<std::pair<std::string, std::string>> dependencies;
+
+/// The IR hash of each written object file, as recorded by writeModule().
+/// Guarded by objectHashesMutex, as modules may be written by the backend
+/// threads.
+llvm::StringMap<std::string> objectHashes;
+std::mutex objectHashesMutex;
+
+/// Memoized content hashes of the dependency files listed in the manifests.
+llvm::StringMap<std::string> dependencyHashes;
+
+bool isFrontendCacheApplicable() {
+  const auto &p = global.params;
+  return cacheFrontend && !opts::cacheDir.empty() && p.obj && p.output_o &&
+         !p.output_bc && !p.output_ll && !p.output_s && !p.oneobj && !p.run &&
+         !p.fullyQualifiedObjectFiles && !p.cleanupObjectFiles &&
+         !p.addMain && !p.doDocComments && !p.doHdrGeneration &&
+         !p.doJsonGeneration && !p.moduleDeps && p.bitcodeFiles->dim == 0;
+}
+
+/// The object code of modules expanding these cannot be reused.
+bool containsTimeDependentTokens(llvm::StringRef source) {
+  return source.find("__DATE__") != llvm::StringRef::npos ||
+         source.find("__TIME__") != llvm::StringRef::npos ||
+         source.find("__TIMESTAMP__") != llvm::StringRef::npos;
+}
+
+// Output to `hash_os` all commandline flags except for the ones that only
+// affect the cache itself or the scheduling of the backend. Contrary to the
+// IR hash, flags like -I, -J, -version or -unittest must be included here.
+void outputFrontendRelevantCmdlineArgs(llvm::raw_ostream &hash_os) {
+  for (size_t i = 1; i < opts::allArguments.size(); ++i) {
+    const char *arg = opts::allArguments[i];
+    if (!arg || !arg[0])
+      continue;
+    if (arg[0] == '-') {
+      if (strncmp(arg + 1, "cache", 5) == 0 || isOutputIrrelevantArg(arg) ||
+          strcmp(arg + 1, "v") == 0 || strcmp(arg + 1, "vv") == 0)
+        continue;
+    }
+    hash_os << arg << '\0';
+  }
+}
+
+void storeManifestFileName(llvm::StringRef key,
+                           llvm::SmallString<128> &filePath) {
+  filePath = opts::cacheDir;
+  llvm::sys::path::append(filePath, key.substr(0, 2),
+                          llvm::Twine("ircache_") + key + ".fe");
+}
+
+/// Returns the hash of the contents of a dependency, or an empty string if it
+/// may not be cached.
+std::string hashDependencyContents(llvm::StringRef contents) {
+  if (containsTimeDependentTokens(contents))
+    return "";
+  raw_hash_ostream hash_os;
+  hash_os << contents;
+  llvm::SmallString<32> str;
+  hash_os.resultAsString(str);
+  return str.str().str();
+}
+
+/// Returns the content hash of the given file, or an empty string if it can't
+/// be read or may not be cached.
+std::string hashDependency(llvm::StringRef filename) {
+  auto it = dependencyHashes.find(filename);
+  if (it != dependencyHashes.end())
+    return it->second;
+
+  std::string result;
+  auto buffer = llvm::MemoryBuffer::getFile(filename);
+  if (buffer)
+    result = hashDependencyContents((*buffer)->getBuffer());
+  dependencyHashes[filename] = result;
+  return result;
+}
+
+/// Reads the manifest for `key`. Returns true and sets `irHash` and
+/// `linkSwitches` if all dependencies listed in it are unchanged.
+bool readManifest(llvm::StringRef key, std::string &irHash,
+                  std::vector<std::string> &linkSwitches) {
+  llvm::SmallString<128> manifestFile;
+  storeManifestFileName(key, manifestFile);
+  auto buffer = llvm::MemoryBuffer::getFile(manifestFile);
+  if (!buffer) {
+    IF_LOG Logger::println("Frontend cache manifest not found.");
+    return false;
+  }
+
+  // Format: the IR hash on the first line, followed by lines
+  // `d <hash> <dependency file>` and `l <linker switch>`.
+  llvm::StringRef rest = (*buffer)->getBuffer();
+  std::pair<llvm::StringRef, llvm::StringRef> line = rest.split('\n');
+  irHash = line.first.str();
+  for (rest = line.second; !rest.empty(); rest = line.second) {
+    line = rest.split('\n');
+    if (line.first.startswith("d ")) {
+      const auto entry = line.first.substr(2).split(' ');
+      if (hashDependency(entry.second) != entry.first) {
+        IF_LOG Logger::println("Dependency changed: %s",
+                               entry.second.str().c_str());
+        return false;
+      }
+    } else if (line.first.startswith("l ")) {
+      linkSwitches.push_back(line.first.substr(2).str());
+    }
+  }
+
+  if (irHash.empty() || cache::cacheLookup(irHash).empty())
+    return false;
+
+  std::string errorMsg;
+  if (!touchCacheFile(manifestFile.c_str(), errorMsg)) {
+    error(Loc(), "%s", errorMsg.c_str());
+    fatal();
+  }
+  addToCacheIndex(manifestFile);
+  return true;
+}
+
+void writeManifest(llvm::StringRef key, llvm::StringRef contents) {
+  llvm::SmallString<128> manifestFile;
+  storeManifestFileName(key, manifestFile);
+
+  // Write to a temporary file first and rename it afterwards, just like the
+  // object files.
+  llvm::SmallString<128> tempFile;
+  std::string errorMsg;
+  if (!prepareCacheFile(manifestFile, tempFile, errorMsg)) {
+    error(Loc(), "%s", errorMsg.c_str());
+    fatal();
   }
+  int FD;
+  if (llvm::sys::fs::openFileForWrite(tempFile, FD, llvm::sys::fs::F_None)) {
+    error(Loc(), "Could not write temporary file in the cache: %s",
+          tempFile.c_str());
+    fatal();
+  }
+  {
+    llvm::raw_fd_ostream os(FD, /*shouldClose=*/true);
+    os << contents;
+  }
+  IF_LOG Logger::println("Rename temp file to cache file: %s to %s",
+                         tempFile.c_str(), manifestFile.c_str());
+  if (llvm::sys::fs::rename(tempFile.c_str(), manifestFile.c_str())) {
+    error(Loc(), "Failed to rename temp file to cache file: %s to %s",
+          tempFile.c_str(), manifestFile.c_str());
+    fatal();
+  }
+  addToCacheIndex(manifestFile);
 }
+
+} // anonymous namespace
+
+namespace cache {
+
+void recordModuleHash(llvm::StringRef objectFile,
+                      llvm::StringRef cacheObjectHash) {
+  if (!frontendCacheEnabled)
+    return;
+  std::lock_guard<std::mutex> lock(objectHashesMutex);
+  objectHashes[objectFile] = cacheObjectHash.str();
+}
+
+void storeFrontendCacheManifests() {
+  if (!frontendCacheEnabled || frontendCacheRecovered ||
+      frontendCacheUncacheable || global.errors)
+    return;
+
+  IF_LOG Logger::println("Store frontend cache manifests");
+  LOG_SCOPE
+
+  // The dependencies have been hashed when they were read, so that files
+  // changed during the compilation are not recorded with their new contents.
+  std::string manifest;
+  for (const auto &dependency : dependencies) {
+    if (dependency.second.empty()) {
+      IF_LOG Logger::println("Cannot cache dependency: %s",
+                             dependency.first.c_str());
+      return;
+    }
+    manifest += "d " + dependency.second + " " + dependency.first + "\n";
+  }
+  // Linker switches added by pragma(lib) during codegen.
+  for (size_t i = numInitialLinkSwitches;
+       i < global.params.linkswitches->dim; ++i) {
+    manifest += std::string("l ") + (*global.params.linkswitches)[i] + "\n";
+  }
+
+  for (const auto &entry : frontendCacheKeys) {
+    const char *objectFile = entry.first->objfile->name->str;
+    auto it = objectHashes.find(objectFile);
+    if (it == objectHashes.end()) {
+      IF_LOG Logger::println("Object file not cached: %s", objectFile);
+      return;
+    }
+    writeManifest(entry.second, it->second + "\n" + manifest);
+  }
+}
+
 } // namespace cache
+
+/// Called by the frontend after reading the root modules. Returns true if the
+/// object files of all root modules have been recovered from the cache.
+bool recoverFromFrontendCache(Modules &modules) {
+  if (!isFrontendCacheApplicable() || modules.empty())
+    return false;
+
+  IF_LOG Logger::println("Use frontend cache in %s", opts::cacheDir.c_str());
+  LOG_SCOPE
+  TimeTrace::Scope timeTraceScope("Frontend cache lookup");
+
+  frontendCacheEnabled = true;
+  numInitialLinkSwitches = global.params.linkswitches->dim;
+
+  // The code generated for a module depends on all root modules (e.g.,
+  // template instances are only emitted into one of them), so all of them
+  // are part of each key.
+  raw_hash_ostream hash_os;
+  hash_os << global.ldc_version << global.version << global.llvm_version
+          << ldc::built_with_Dcompiler_version;
+  outputFrontendRelevantCmdlineArgs(hash_os);
+  llvm::SmallString<128> cwd;
+  if (!llvm::sys::fs::current_path(cwd))
+    hash_os << cwd;
+  hash_os << '\0';
+  for (auto ids : {global.params.versionids, global.params.debugids}) {
+    if (ids) {
+      for (const char *id : *ids)
+        hash_os << id << '\0';
+    }
+    hash_os << '\0';
+  }
+  for (Module *m : modules) {
+    const llvm::StringRef source(
+        reinterpret_cast<const char *>(m->srcfile->buffer), m->srcfile->len);
+    if (m->isDocFile || containsTimeDependentTokens(source)) {
+      frontendCacheUncacheable = true;
+      return false;
+    }
+    hash_os << m->srcfile->toChars() << '\0' << source.size() << '\0'
+            << source;
+  }
+
+  std::vector<std::string> irHashes;
+  std::vector<std::string> linkSwitches;
+  bool allFound = true;
+  for (Module *m : modules) {
+    raw_hash_ostream module_os;
+    llvm::SmallString<32> key;
+    hash_os.resultAsString(key);
+    module_os << key << m->srcfile->toChars();
+    module_os.resultAsString(key);
+    frontendCacheKeys.emplace_back(m, key.str().str());
+
+    IF_LOG Logger::println("Frontend cache key of %s: %s",
+                           m->srcfile->toChars(), key.c_str());
+    std::string irHash;
+    if (allFound && readManifest(key, irHash, linkSwitches)) {
+      irHashes.push_back(std::move(irHash));
+    } else {
+      allFound = false;
+    }
+  }
+
+  if (!allFound) {
+    IF_LOG Logger::println("Not all modules found in frontend cache.");
+    return false;
+  }
+
+  for (size_t i = 0; i < modules.dim; ++i) {
+    Module *m = modules[i];
+    const char *objectFile = m->objfile->name->str;
+    const auto directory = llvm::sys::path::parent_path(objectFile);
+    if (!directory.empty()) {
+      if (auto ec = llvm::sys::fs::create_directories(directory)) {
+        error(Loc(), "failed to create output directory: %s\n%s",
+              directory.str().c_str(), ec.message().c_str());
+        fatal();
+      }
+    }
+    if (global.params.verbose)
+      fprintf(global.stdmsg, "cached    %s\n", m->toChars());
+    std::string errorMsg;
+    if (!cache::recoverObjectFile(irHashes[i], objectFile, errorMsg)) {
+      error(Loc(), "%s", errorMsg.c_str());
+      fatal();
+    }
+
+    for (auto &objfile : *global.params.objfiles) {
+      if (objfile == reinterpret_cast<const char *>(m)) {
+        objfile = objectFile;
+        break;
+      }
+    }
+  }
+
+  for (const auto &linkSwitch : linkSwitches) {
+    bool known = false;
+    for (const char *s : *global.params.linkswitches)
+      known = known || linkSwitch == s;
+    if (!known)
+      global.params.linkswitches->push(mem.xstrdup(linkSwitch.c_str()));
+  }
+
+  frontendCacheRecovered = true;
+  return true;
+}
+
+/// Called by the frontend for each imported module and each file read via a
+/// string import, right after reading it.
+void recordDependency(const char *filename, const void *contents,
+                      size_t size) {
+  if (frontendCacheEnabled) {
+    dependencies.emplace_back(
+        filename, hashDependencyContents(llvm::StringRef(
+                      static_cast<const char *>(contents), size)));
+  }
+}
@@ -21,11 +21,41 @@ template <unsigned> class SmallString;
 namespace cache {
 
 void calculateModuleHash(llvm::Module *m, llvm::SmallString<32> &str);
+/// Like above, but hashes an existing bitcode serialization of the module
+/// (as written by llvm::WriteBitcodeToFile()) instead of serializing it again.
+void calculateModuleHash(llvm::StringRef moduleBitcode,
+                         llvm::SmallString<32> &str);
+/// Returns true if object files are cached (-cache or -cache-daemon).
+bool isEnabled();
+/// Returns the cache directory or daemon socket, for diagnostics.
+std::string cacheLocation();
 std::string cacheLookup(llvm::StringRef cacheObjectHash);
-void cacheObjectFile(llvm::StringRef objectFile,
-                     llvm::StringRef cacheObjectHash);
-void recoverObjectFile(llvm::StringRef cacheObjectHash,
-                       llvm::StringRef objectFile);
+
+// The following functions are used by writeModule() on the backend threads.
+// Instead of reporting errors, they return false and set `errorMsg`.
+
+bool cacheObjectFile(llvm::StringRef objectFile,
+                     llvm::StringRef cacheObjectHash, std::string &errorMsg);
+bool recoverObjectFile(llvm::StringRef cacheObjectHash,
+                       llvm::StringRef objectFile, std::string &errorMsg);
+/// Returns a temporary file in the cache into which a new object file can be
+/// written directly, avoiding a copy in cacheObjectFile(). Returns an empty
+/// string if the cache doesn't support this, or on error (`errorMsg` set).
+std::string createTempObjectFile(llvm::StringRef cacheObjectHash,
+                                 std::string &errorMsg);
+/// Moves an object file written to the file returned by createTempObjectFile()
+/// into the cache, and retrieves it to `objectFile` (as a reflink or link if
+/// possible, see -cache-retrieval).
+bool commitObjectFile(llvm::StringRef tempFile, llvm::StringRef cacheObjectHash,
+                      llvm::StringRef objectFile, std::string &errorMsg);
+
+/// Remembers the IR hash of a written or recovered object file for the
+/// frontend cache manifests (-cache-frontend). Thread-safe.
+void recordModuleHash(llvm::StringRef objectFile,
+                      llvm::StringRef cacheObjectHash);
+/// Writes the frontend cache manifests of all root modules, once all object
+/// files have been written.
+void storeFrontendCacheManifests();
 
 /// Prune the cache to avoid filling up disk space.
 ///
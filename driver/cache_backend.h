@@ -0,0 +1,76 @@
+//===-- driver/cache_backend.h - Object file cache storage ------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Storage backends of the IR-to-object cache (see driver/cache.h): the cache
+// directory (`-cache`), and a cache daemon shared by all compiler processes
+// on a host (`-cache-daemon`).
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_CACHE_BACKEND_H
+#define LDC_DRIVER_CACHE_BACKEND_H
+
+#include "llvm/ADT/StringRef.h"
+#include <memory>
+#include <string>
+
+namespace cache {
+
+/// Stores object files by their (hex) cache hash. Implementations must be
+/// thread-safe, as objects may be written by the backend threads (-j).
+class CacheBackend {
+public:
+  virtual ~CacheBackend() = default;
+
+  /// Returns a description of where the cache lives, for diagnostics.
+  virtual std::string location() const = 0;
+
+  /// Returns a non-empty description of the cached object (e.g., its file
+  /// name) if the cache contains the object with the given hash. A later
+  /// recover() of that object must succeed.
+  virtual std::string lookup(llvm::StringRef cacheObjectHash) = 0;
+
+  // The following functions may be called by the backend threads, so they
+  // don't report errors themselves. They return false (or an empty string)
+  // and set `errorMsg` instead.
+
+  /// Adds the object file to the cache.
+  virtual bool store(llvm::StringRef objectFile,
+                     llvm::StringRef cacheObjectHash,
+                     std::string &errorMsg) = 0;
+
+  /// Writes a cached object, previously found by lookup(), to `objectFile`.
+  virtual bool recover(llvm::StringRef cacheObjectHash,
+                       llvm::StringRef objectFile, std::string &errorMsg) = 0;
+
+  /// Returns a temporary file into which the object can be written directly,
+  /// to be added with commitObjectFile() afterwards, or an empty string if
+  /// the backend doesn't support this (the default) or on error.
+  virtual std::string createTempObjectFile(llvm::StringRef cacheObjectHash,
+                                           std::string &errorMsg) {
+    return "";
+  }
+
+  /// Adds the object written to the file returned by createTempObjectFile()
+  /// to the cache, and makes it available as `objectFile`.
+  virtual bool commitObjectFile(llvm::StringRef tempFile,
+                                llvm::StringRef cacheObjectHash,
+                                llvm::StringRef objectFile,
+                                std::string &errorMsg) {
+    return true;
+  }
+};
+
+/// Creates the backend talking to the cache daemon (ldc-cache-daemon)
+/// listening on the given Unix domain socket.
+std::unique_ptr<CacheBackend>
+createDaemonCacheBackend(llvm::StringRef socketPath);
+}
+
+#endif
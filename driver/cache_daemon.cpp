@@ -0,0 +1,260 @@
+//===-- cache_daemon.cpp --------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Client side of the cache daemon protocol (see tools/ldc-cache-daemon.d).
+//
+// Each request uses its own connection to the daemon's Unix domain socket.
+// A request consists of a one-byte opcode and the 32-character object hash:
+//   'G' (get): the daemon answers 'Y', followed by the object size as 64-bit
+//              little-endian integer and the object data, or 'N'.
+//   'P' (put): followed by the object size and data; the daemon answers 'Y',
+//              or 'N' right after the size if the object is too large.
+// Objects are at most `maxObjectSize` bytes large.
+// The daemon being unreachable is treated like a cache miss. Both sides time
+// out if the other doesn't make progress, so that the daemon can't block the
+// compiler indefinitely.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/cache_backend.h"
+
+#include "ddmd/errors.h"
+#include "gen/logger.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+#include <mutex>
+
+#if LDC_POSIX
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // Darwin: SO_NOSIGPIPE is set instead
+#endif
+#endif
+
+namespace cache {
+
+namespace {
+
+/// Must match `maxObjectSize` in tools/ldc-cache-daemon.d.
+constexpr uint64_t maxObjectSize = uint64_t(1) << 30;
+
+#if LDC_POSIX
+/// A connection to the cache daemon, for a single request.
+class DaemonConnection {
+  int fd = -1;
+
+public:
+  explicit DaemonConnection(const std::string &socketPath) {
+    sockaddr_un address;
+    if (socketPath.size() >= sizeof(address.sun_path))
+      return;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&address),
+                           sizeof(address)) != 0) {
+      close(fd);
+      fd = -1;
+    }
+#ifdef SO_NOSIGPIPE
+    if (fd >= 0) {
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    }
+#endif
+    if (fd >= 0) {
+      timeval timeout = {10, 0};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+  }
+  ~DaemonConnection() {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  bool isOpen() const { return fd >= 0; }
+
+  bool send(const void *data, size_t size) {
+    auto p = static_cast<const char *>(data);
+    while (size > 0) {
+      const ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+      if (n <= 0)
+        return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool receive(void *data, size_t size) {
+    auto p = static_cast<char *>(data);
+    while (size > 0) {
+      const ssize_t n = ::recv(fd, p, size, 0);
+      if (n <= 0)
+        return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool sendRequest(char opcode, llvm::StringRef cacheObjectHash) {
+    return send(&opcode, 1) &&
+           send(cacheObjectHash.data(), cacheObjectHash.size());
+  }
+
+  bool sendSize(uint64_t size) {
+    char buffer[8];
+    llvm::support::endian::write64le(buffer, size);
+    return send(buffer, sizeof(buffer));
+  }
+
+  bool receiveSize(uint64_t &size) {
+    char buffer[8];
+    if (!receive(buffer, sizeof(buffer)))
+      return false;
+    size = llvm::support::endian::read64le(buffer);
+    return true;
+  }
+};
+#endif
+
+class DaemonCacheBackend : public CacheBackend {
+  const std::string socketPath;
+
+  /// Objects received by lookup(), to be written by recover().
+  llvm::StringMap<std::string> fetchedObjects;
+  std::mutex fetchedObjectsMutex;
+
+public:
+  explicit DaemonCacheBackend(llvm::StringRef socketPath)
+      : socketPath(socketPath) {}
+
+  std::string location() const override { return socketPath; }
+
+  std::string lookup(llvm::StringRef cacheObjectHash) override {
+#if LDC_POSIX
+    DaemonConnection connection(socketPath);
+    if (!connection.isOpen()) {
+      IF_LOG Logger::println("Cache daemon not reachable: %s",
+                             socketPath.c_str());
+      return "";
+    }
+
+    char answer = 0;
+    uint64_t size;
+    if (!connection.sendRequest('G', cacheObjectHash) ||
+        !connection.receive(&answer, 1) || answer != 'Y' ||
+        !connection.receiveSize(size) || size > maxObjectSize) {
+      IF_LOG Logger::println("Cache object not found.");
+      return "";
+    }
+    std::string data(size, '\0');
+    if (!connection.receive(&data[0], size)) {
+      IF_LOG Logger::println("Cache object not found.");
+      return "";
+    }
+
+    IF_LOG Logger::println("Cache object found! (%llu bytes from %s)",
+                           static_cast<unsigned long long>(size),
+                           socketPath.c_str());
+    std::lock_guard<std::mutex> lock(fetchedObjectsMutex);
+    fetchedObjects[cacheObjectHash] = std::move(data);
+    return (llvm::Twine(socketPath) + ":" + cacheObjectHash).str();
+#else
+    return "";
+#endif
+  }
+
+  bool store(llvm::StringRef objectFile, llvm::StringRef cacheObjectHash,
+             std::string &errorMsg) override {
+#if LDC_POSIX
+    auto buffer = llvm::MemoryBuffer::getFile(objectFile);
+    if (!buffer) {
+      errorMsg = ("Failed to read object file for the cache: " + objectFile)
+                     .str();
+      return false;
+    }
+
+    IF_LOG Logger::println("Send object file to cache daemon: %s",
+                           objectFile.str().c_str());
+    const llvm::StringRef data = (*buffer)->getBuffer();
+    DaemonConnection connection(socketPath);
+    char answer = 0;
+    if (!connection.isOpen() || !connection.sendRequest('P', cacheObjectHash) ||
+        !connection.sendSize(data.size()) ||
+        !connection.send(data.data(), data.size()) ||
+        !connection.receive(&answer, 1) || answer != 'Y') {
+      IF_LOG Logger::println("Failed to store object in cache daemon: %s",
+                             socketPath.c_str());
+    }
+#endif
+    // The daemon being unavailable is not an error.
+    return true;
+  }
+
+  bool recover(llvm::StringRef cacheObjectHash, llvm::StringRef objectFile,
+               std::string &errorMsg) override {
+    std::string data;
+    {
+      std::lock_guard<std::mutex> lock(fetchedObjectsMutex);
+      auto it = fetchedObjects.find(cacheObjectHash);
+      if (it == fetchedObjects.end()) {
+        errorMsg = ("Object " + cacheObjectHash +
+                    " was not fetched from the cache daemon")
+                       .str();
+        return false;
+      }
+      data = std::move(it->second);
+      fetchedObjects.erase(it);
+    }
+
+    IF_LOG Logger::println("Write cached object file: %s",
+                           objectFile.str().c_str());
+    llvm::sys::fs::remove(objectFile);
+    int FD;
+    if (llvm::sys::fs::openFileForWrite(objectFile, FD,
+                                        llvm::sys::fs::F_None)) {
+      errorMsg =
+          ("Failed to write the cached object file: " + objectFile).str();
+      return false;
+    }
+    llvm::raw_fd_ostream os(FD, /*shouldClose=*/true);
+    os << data;
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      errorMsg =
+          ("Failed to write the cached object file: " + objectFile).str();
+      return false;
+    }
+    return true;
+  }
+};
+}
+
+std::unique_ptr<CacheBackend>
+createDaemonCacheBackend(llvm::StringRef socketPath) {
+#if !LDC_POSIX
+  error(Loc(), "-cache-daemon is only supported on POSIX systems");
+  fatal();
+#endif
+  return std::unique_ptr<CacheBackend>(new DaemonCacheBackend(socketPath));
+}
+}
@@ -403,6 +403,19 @@ cl::opt<uint32_t, true> hashThreshold(
     cl::desc("hash symbol names longer than this threshold (experimental)"),
     cl::location(global.params.hashThreshold), cl::init(0));
 
+cl::opt<uint32_t, true> parseThreads(
+    "parse-threads",
+    cl::desc("Lex and parse the source files on up to <N> threads "
+             "(0: one per hardware thread, default: 1)"),
+    cl::value_desc("N"), cl::location(global.params.parseThreads),
+    cl::init(1), cl::ZeroOrMore);
+
+static cl::opt<bool, true>
+    ctfeBytecode("ctfe-bytecode",
+                 cl::desc("Evaluate CTFE calls of simple integer functions "
+                          "with a bytecode interpreter (experimental)"),
+                 cl::location(global.params.ctfeBytecode), cl::ZeroOrMore);
+
 cl::opt<bool> linkonceTemplates(
     "linkonce-templates",
     cl::desc(
@@ -481,6 +494,15 @@ cl::opt<LTOKind> ltoMode(
                    "Parallel importing and codegen (faster than 'full')")));
 #endif
 
+#if LDC_LLVM_VER >= 400
+cl::opt<bool> wholeProgramVtables(
+    "fwhole-program-vtables",
+    cl::desc("Enable whole-program devirtualization of virtual calls with "
+             "-flto=full; all classes deriving from the program's classes "
+             "must be compiled with this option (LLVM >= 4.0)"),
+    cl::ZeroOrMore);
+#endif
+
 static cl::extrahelp footer(
     "\n"
     "-d-debug can also be specified without options, in which case it enables "
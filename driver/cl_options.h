@@ -120,5 +120,12 @@ inline bool isUsingThinLTO() { return ltoMode == LTO_Thin; }
 inline bool isUsingLTO() { return false; }
 inline bool isUsingThinLTO() { return false; }
 #endif
+
+#if LDC_LLVM_VER >= 400
+extern cl::opt<bool> wholeProgramVtables;
+inline bool isUsingWholeProgramVtables() { return wholeProgramVtables; }
+#else
+inline bool isUsingWholeProgramVtables() { return false; }
+#endif
 }
 #endif
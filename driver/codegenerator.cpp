@@ -13,11 +13,15 @@
 #include "mars.h"
 #include "module.h"
 #include "scope.h"
+#include "driver/backendpool.h"
+#include "driver/cl_options.h"
 #include "driver/linker.h"
+#include "driver/timetrace.h"
 #include "driver/toobj.h"
 #include "gen/logger.h"
 #include "gen/modules.h"
 #include "gen/runtime.h"
+#include "llvm/Support/FileSystem.h"
 
 /// The module with the frontend-generated C main() definition.
 extern Module *g_entrypointModule;
@@ -110,6 +114,22 @@ CodeGenerator::CodeGenerator(llvm::LLVMContext &context, bool singleObj)
     context_.setDiscardValueNames(true);
   }
 #endif
+
+  // Make the cache directory absolute up-front, as the backend threads only
+  // read the option.
+  if (!opts::cacheDir.empty()) {
+    llvm::SmallString<128> cacheDir(opts::cacheDir.c_str());
+    llvm::sys::fs::make_absolute(cacheDir);
+    opts::cacheDir = cacheDir.c_str();
+  }
+
+  // There is nothing to parallelize for a single output object file.
+  if (!singleObj_) {
+    const unsigned numThreads = getBackendThreadCount();
+    if (numThreads > 0) {
+      backend_.reset(new BackendPool(numThreads));
+    }
+  }
 }
 
 CodeGenerator::~CodeGenerator() {
@@ -125,6 +145,9 @@ CodeGenerator::~CodeGenerator() {
 
     writeAndFreeLLModule(filename);
   }
+
+  // Wait for the backend threads to finish writing all modules.
+  backend_.reset();
 }
 
 void CodeGenerator::prepareLLModule(Module *m) {
@@ -189,7 +212,15 @@ void CodeGenerator::writeAndFreeLLModule(const char *filename) {
       {llvm::MDString::get(ir_->context(), Version)};
   IdentMetadata->addOperand(llvm::MDNode::get(ir_->context(), IdentNode));
 
-  writeModule(&ir_->module, filename);
+  if (backend_) {
+    backend_->submit(ir_->module, filename);
+  } else if (global.params.verbose) {
+    ModuleWriteTimes times;
+    writeModule(&ir_->module, filename, &times);
+    printModuleWriteTimes(filename, times);
+  } else {
+    writeModule(&ir_->module, filename);
+  }
   delete ir_;
   ir_ = nullptr;
 }
@@ -220,6 +251,8 @@ void CodeGenerator::emit(Module *m) {
   IF_LOG Logger::println("CodeGenerator::emit(%s)", m->toPrettyChars());
   LOG_SCOPE;
 
+  TimeTrace::Scope timeTraceScope("Generate IR", m->toPrettyChars());
+
   if (global.params.verbose_cg) {
     printf("codegen: %s (%s)\n", m->toPrettyChars(), m->srcfile->toChars());
   }
@@ -21,9 +21,12 @@
 #define LDC_DRIVER_CODEGENERATOR_H
 
 #include "gen/irstate.h"
+#include <memory>
 
 namespace ldc {
 
+class BackendPool;
+
 class CodeGenerator {
 public:
   CodeGenerator(llvm::LLVMContext &context, bool singleObj);
@@ -39,6 +42,8 @@ private:
   int moduleCount_;
   bool const singleObj_;
   IRState *ir_;
+  /// Worker threads for optimization and emission, if enabled (see -j).
+  std::unique_ptr<BackendPool> backend_;
 };
 }
 
@@ -13,7 +13,10 @@
 #include "root.h"
 #include "driver/cl_options.h"
 #include "driver/exe_path.h"
+#include "driver/ltobackend.h"
+#include "driver/timetrace.h"
 #include "driver/tool.h"
+#include "gen/gcprofiling.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/logger.h"
@@ -268,9 +271,9 @@ void insertBitcodeFiles(llvm::Module &M, llvm::LLVMContext &Ctx,
 
 //////////////////////////////////////////////////////////////////////////////
 
-static void appendObjectFiles(std::vector<std::string> &args) {
-  for (unsigned i = 0; i < global.params.objfiles->dim; i++)
-    args.push_back((*global.params.objfiles)[i]);
+static void appendObjectFiles(std::vector<std::string> &args,
+                              const std::vector<std::string> &objectFiles) {
+  args.insert(args.end(), objectFiles.begin(), objectFiles.end());
 
   if (global.params.targetTriple->isWindowsMSVCEnvironment()) {
     if (global.params.resfile)
@@ -284,7 +287,8 @@ static void appendObjectFiles(std::vector<std::string> &args) {
 
 static std::string gExePath;
 
-static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
+static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic,
+                              const std::vector<std::string> &objectFiles) {
   Logger::println("*** Linking executable ***");
 
   // find gcc for linking
@@ -293,7 +297,7 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
   // build arguments
   std::vector<std::string> args;
 
-  appendObjectFiles(args);
+  appendObjectFiles(args, objectFiles);
 
   // Link with profile-rt library when generating an instrumented binary.
   // profile-rt uses Phobos (MD5 hashing) and therefore must be passed on the
@@ -308,6 +312,9 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
     }
 #endif
     args.push_back("-lldc-profile-rt");
+  } else if (isProfilingGCAllocations()) {
+    // The GC allocation profile is written by profile-rt (ldc.gcprofile).
+    args.push_back("-lldc-profile-rt");
   }
 
   // user libs
@@ -350,7 +357,7 @@ static int linkObjToBinaryGcc(bool sharedLib, bool fullyStatic) {
 
   // Add LTO link flags before adding the user link switches, such that the user
   // can pass additional options to the LTO plugin.
-  if (opts::isUsingLTO())
+  if (opts::isUsingLTO() && !ldc::isUsingInProcessLTO())
     addLTOLinkFlags(args);
 
   // additional linker switches
@@ -690,7 +697,8 @@ int executeMsvcToolAndWait(const std::string &,
 
 //////////////////////////////////////////////////////////////////////////////
 
-static int linkObjToBinaryMSVC(bool sharedLib) {
+static int linkObjToBinaryMSVC(bool sharedLib,
+                               const std::vector<std::string> &objectFiles) {
   Logger::println("*** Linking executable ***");
 
   std::string tool = "link.exe";
@@ -735,11 +743,11 @@ static int linkObjToBinaryMSVC(bool sharedLib) {
 
   args.push_back("/OUT:" + output);
 
-  appendObjectFiles(args);
+  appendObjectFiles(args, objectFiles);
 
   // Link with profile-rt library when generating an instrumented binary
   // profile-rt depends on Phobos (MD5 hashing).
-  if (global.params.genInstrProf) {
+  if (global.params.genInstrProf || isProfilingGCAllocations()) {
     args.push_back("ldc-profile-rt.lib");
     // profile-rt depends on ws2_32 for symbol `gethostname`
     args.push_back("ws2_32.lib");
@@ -800,12 +808,31 @@ static int linkObjToBinaryMSVC(bool sharedLib) {
 //////////////////////////////////////////////////////////////////////////////
 
 int linkObjToBinary() {
+  TimeTrace::Scope timeTraceScope("Link", global.params.exefile);
+
+  std::vector<std::string> objectFiles(global.params.objfiles->begin(),
+                                       global.params.objfiles->end());
+
+  // Replace the bitcode files by native object files if we do LTO ourselves.
+  std::vector<std::string> tempFiles;
+  if (ldc::isUsingInProcessLTO() &&
+      !ldc::runInProcessLTO(objectFiles, tempFiles)) {
+    return 1;
+  }
+
+  int status;
   if (global.params.targetTriple->isWindowsMSVCEnvironment()) {
     // TODO: Choose dynamic/static MSVCRT version based on staticFlag?
-    return linkObjToBinaryMSVC(global.params.dll);
+    status = linkObjToBinaryMSVC(global.params.dll, objectFiles);
+  } else {
+    status = linkObjToBinaryGcc(global.params.dll, staticFlag, objectFiles);
   }
 
-  return linkObjToBinaryGcc(global.params.dll, staticFlag);
+  for (const auto &file : tempFiles) {
+    llvm::sys::fs::remove(file);
+  }
+
+  return status;
 }
 
 //////////////////////////////////////////////////////////////////////////////
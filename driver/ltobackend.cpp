@@ -0,0 +1,251 @@
+//===-- ltobackend.cpp ----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/ltobackend.h"
+
+#include "mars.h"
+#include "driver/backendpool.h"
+#include "driver/cl_options.h"
+#include "driver/timetrace.h"
+#include "gen/irstate.h"
+#include "gen/logger.h"
+#include "gen/optimizer.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#if LDC_LLVM_VER >= 400
+#include "llvm/LTO/Caching.h"
+#include "llvm/LTO/LTO.h"
+#include "llvm/Object/SymbolicFile.h"
+#include "llvm/Support/Error.h"
+#endif
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+static llvm::cl::opt<bool> ltoInProcess(
+    "flto-inprocess",
+    llvm::cl::desc("Perform LTO in the compiler, using up to -j threads, and "
+                   "pass native object files to the linker instead of "
+                   "relying on its LTO plugin (LLVM >= 4.0)"),
+    llvm::cl::ZeroOrMore);
+
+namespace ldc {
+
+bool isUsingInProcessLTO() {
+#if LDC_LLVM_VER >= 400
+  return ltoInProcess && opts::isUsingLTO();
+#else
+  return false;
+#endif
+}
+
+#if LDC_LLVM_VER >= 400
+namespace {
+
+/// Reports `err` (if any) as compile error. Returns true upon error.
+bool reportError(llvm::Error err, const char *what) {
+  if (!err)
+    return false;
+  std::string message;
+  llvm::handleAllErrors(std::move(err), [&](const llvm::ErrorInfoBase &info) {
+    message = info.message();
+  });
+  error(Loc(), "%s: %s", what, message.c_str());
+  return true;
+}
+
+/// Sets up the LTO code generation to match gTargetMachine.
+llvm::lto::Config createLTOConfig() {
+  const llvm::TargetMachine &target = *gTargetMachine;
+
+  llvm::lto::Config conf;
+  conf.CPU = target.getTargetCPU();
+  llvm::SmallVector<llvm::StringRef, 16> features;
+  target.getTargetFeatureString().split(features, ',', -1, false);
+  for (auto feature : features)
+    conf.MAttrs.push_back(feature.str());
+  conf.Options = target.Options;
+  conf.RelocModel = target.getRelocationModel();
+  conf.CodeModel = target.getCodeModel();
+  conf.CGOptLevel = target.getOptLevel();
+  conf.OptLevel = std::min(optLevel(), 3u);
+  conf.DefaultTriple = target.getTargetTriple().str();
+  return conf;
+}
+}
+
+bool runInProcessLTO(std::vector<std::string> &objectFiles,
+                     std::vector<std::string> &tempFiles) {
+  Logger::println("*** Running LTO ***");
+  LOG_SCOPE
+  TimeTrace::Scope timeTraceScope("LTO");
+
+  const unsigned numThreads = std::max(1u, getBackendThreadCount());
+  llvm::lto::LTO lto(createLTOConfig(),
+                     llvm::lto::createInProcessThinBackend(numThreads));
+
+  // The LTO inputs refer to the file buffers until LTO has finished.
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+  std::vector<std::unique_ptr<llvm::lto::InputFile>> inputs;
+  std::vector<const std::string *> inputFileNames;
+  std::vector<std::string> outputFiles;
+
+  for (const auto &file : objectFiles) {
+    auto buffer = llvm::MemoryBuffer::getFile(file);
+    if (!buffer) {
+      error(Loc(), "cannot read file '%s': %s", file.c_str(),
+            buffer.getError().message().c_str());
+      return false;
+    }
+    if (llvm::sys::fs::identify_magic((*buffer)->getBuffer()) !=
+        llvm::sys::fs::file_magic::bitcode) {
+      outputFiles.push_back(file);
+      continue;
+    }
+
+    Logger::println("Adding LTO input: %s", file.c_str());
+    auto input = llvm::lto::InputFile::create((*buffer)->getMemBufferRef());
+    if (!input) {
+      reportError(input.takeError(), file.c_str());
+      return false;
+    }
+    inputs.push_back(std::move(*input));
+    inputFileNames.push_back(&file);
+    buffers.push_back(std::move(*buffer));
+  }
+
+  // As there is no linker to resolve the symbols, do it like one would: the
+  // first strong definition of a symbol prevails, or else its first weak
+  // (weak, linkonce or common) definition. Multiple strong definitions are
+  // an error.
+  struct Definition {
+    size_t input;
+    bool isWeak;
+  };
+  llvm::StringMap<Definition> prevailingDefinitions;
+  bool hasDuplicates = false;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    for (const auto &symbol : inputs[i]->symbols()) {
+      const uint32_t flags = symbol.getFlags();
+      if (flags & llvm::object::BasicSymbolRef::SF_Undefined)
+        continue;
+      const bool isWeak = flags & (llvm::object::BasicSymbolRef::SF_Weak |
+                                   llvm::object::BasicSymbolRef::SF_Common);
+      auto it =
+          prevailingDefinitions.insert({symbol.getName(), {i, isWeak}});
+      if (it.second || isWeak)
+        continue;
+      Definition &prevailing = it.first->second;
+      if (!prevailing.isWeak) {
+        hasDuplicates = true;
+        error(Loc(), "duplicate symbol '%s' in '%s' and '%s'",
+              symbol.getName().str().c_str(),
+              inputFileNames[prevailing.input]->c_str(),
+              inputFileNames[i]->c_str());
+        continue;
+      }
+      prevailing = {i, false};
+    }
+  }
+  if (hasDuplicates)
+    return false;
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    std::vector<llvm::lto::SymbolResolution> resolutions;
+    for (const auto &symbol : inputs[i]->symbols()) {
+      llvm::lto::SymbolResolution resolution;
+      const bool undefined =
+          symbol.getFlags() & llvm::object::BasicSymbolRef::SF_Undefined;
+      resolution.Prevailing =
+          !undefined && prevailingDefinitions[symbol.getName()].input == i;
+      // The native object files and libraries we link against may refer to
+      // any symbol, so none can be internalized.
+      resolution.VisibleToRegularObj = true;
+      resolutions.push_back(resolution);
+    }
+
+    if (reportError(lto.add(std::move(inputs[i]), resolutions),
+                    inputFileNames[i]->c_str()))
+      return false;
+  }
+
+  // Tasks are run in parallel; each only accesses its own slots.
+  const unsigned numTasks = lto.getMaxTasks();
+  std::vector<std::string> ltoFiles(numTasks);
+  std::vector<char> isTempFile(numTasks, 0);
+
+  // Called on the LTO threads, so failures are reported after lto.run().
+  // The output of a failed task is discarded.
+  std::mutex streamErrorMutex;
+  std::string streamError;
+  auto addStream =
+      [&](unsigned task) -> std::unique_ptr<llvm::lto::NativeObjectStream> {
+    int fd;
+    llvm::SmallString<128> path;
+    auto ec =
+        llvm::sys::fs::createTemporaryFile("ldc-lto", global.obj_ext, fd, path);
+    if (ec) {
+      std::lock_guard<std::mutex> lock(streamErrorMutex);
+      streamError = ec.message();
+      return llvm::make_unique<llvm::lto::NativeObjectStream>(
+          llvm::make_unique<llvm::raw_null_ostream>());
+    }
+    ltoFiles[task] = path.str();
+    isTempFile[task] = 1;
+    return llvm::make_unique<llvm::lto::NativeObjectStream>(
+        llvm::make_unique<llvm::raw_fd_ostream>(fd, /*shouldClose=*/true));
+  };
+
+  // Use the IR-to-object cache directory for caching the native objects of
+  // the LTO backend too. Cache hits are linked directly from the cache.
+  llvm::lto::NativeObjectCache cache;
+  if (!opts::cacheDir.empty()) {
+    if (auto ec = llvm::sys::fs::create_directories(opts::cacheDir)) {
+      error(Loc(), "Unable to create cache directory: %s\n%s",
+            opts::cacheDir.c_str(), ec.message().c_str());
+      return false;
+    }
+    cache = llvm::lto::localCache(
+        opts::cacheDir, [&](unsigned task, llvm::StringRef path) {
+          ltoFiles[task] = path.str();
+        });
+  }
+
+  if (reportError(lto.run(addStream, cache), "LTO failed"))
+    return false;
+  if (!streamError.empty()) {
+    error(Loc(), "could not create temporary file for LTO output: %s",
+          streamError.c_str());
+    return false;
+  }
+
+  for (unsigned task = 0; task < numTasks; ++task) {
+    if (ltoFiles[task].empty())
+      continue;
+    Logger::println("LTO output: %s", ltoFiles[task].c_str());
+    outputFiles.push_back(ltoFiles[task]);
+    if (isTempFile[task])
+      tempFiles.push_back(ltoFiles[task]);
+  }
+
+  objectFiles = std::move(outputFiles);
+  return true;
+}
+#else
+bool runInProcessLTO(std::vector<std::string> &objectFiles,
+                     std::vector<std::string> &tempFiles) {
+  llvm_unreachable("In-process LTO requires LLVM >= 4.0");
+}
+#endif
+}
@@ -0,0 +1,39 @@
+//===-- driver/ltobackend.h - In-process LTO --------------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs the LTO backend (for ThinLTO: the thin-link, the cross-module importing
+// and the per-module optimization and codegen) inside the compiler, instead of
+// relying on the LTO plugin of the system linker. The resulting native object
+// files are then passed to the linker like regular object files.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_LTOBACKEND_H
+#define LDC_DRIVER_LTOBACKEND_H
+
+#include <string>
+#include <vector>
+
+namespace ldc {
+
+/// Returns true if LTO is to be performed by the compiler itself
+/// (`-flto-inprocess`), rather than by the linker.
+bool isUsingInProcessLTO();
+
+/// Replaces the LLVM bitcode files in `objectFiles` by the native object files
+/// resulting from LTO. Files in `objectFiles` that are not bitcode are kept.
+/// Temporary object files that are to be removed after linking are added to
+/// `tempFiles`; if a cache directory is set (`-cache`), the object files are
+/// written into the cache instead.
+/// Returns false on error.
+bool runInProcessLTO(std::vector<std::string> &objectFiles,
+                     std::vector<std::string> &tempFiles);
+}
+
+#endif
@@ -27,6 +27,7 @@
 #include "driver/ldc-version.h"
 #include "driver/linker.h"
 #include "driver/targetmachine.h"
+#include "driver/timetrace.h"
 #include "gen/cl_helpers.h"
 #include "gen/irstate.h"
 #include "gen/linkage.h"
@@ -57,10 +58,12 @@
 #endif
 #include "llvm/LinkAllIR.h"
 #include "llvm/IR/LLVMContext.h"
+#include <algorithm>
 #include <assert.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <thread>
 #if _WIN32
 #include <windows.h>
 #endif
@@ -571,6 +574,16 @@ void parseCommandLine(int argc, char **argv, Strings &sourceFiles,
   if (soname.getNumOccurrences() > 0 && !global.params.dll) {
     error(Loc(), "-soname can be used only when building a shared library");
   }
+
+  if (isUsingWholeProgramVtables() && (!isUsingLTO() || isUsingThinLTO())) {
+    error(Loc(), "-fwhole-program-vtables can be used only together with "
+                 "-flto=full");
+  }
+
+  if (global.params.parseThreads == 0) {
+    global.params.parseThreads =
+        std::max(1u, std::thread::hardware_concurrency());
+  }
 }
 
 void initializePasses() {
@@ -1019,6 +1032,8 @@ int cppmain(int argc, char **argv) {
     global.lib_ext = "a";
   }
 
+  TimeTrace::writeAtExit(files.dim ? files[0] : nullptr);
+
   Strings libmodules;
   return mars_mainBody(files, libmodules);
 }
@@ -1053,6 +1068,7 @@ void codegenModules(Modules &modules) {
     }
   }
 
+  cache::storeFrontendCacheManifests();
   cache::pruneCache();
 
   freeRuntime();
@@ -632,3 +632,11 @@ createTargetMachine(std::string targetTriple, std::string arch, std::string cpu,
                                      targetOptions, relocModel, codeModel,
                                      codeGenOptLevel);
 }
+
+llvm::TargetMachine *cloneTargetMachine(const llvm::TargetMachine &target) {
+  return target.getTarget().createTargetMachine(
+      target.getTargetTriple().str(), target.getTargetCPU(),
+      target.getTargetFeatureString(), target.Options,
+      target.getRelocationModel(), target.getCodeModel(),
+      target.getOptLevel());
+}
@@ -58,6 +58,15 @@ llvm::TargetMachine *createTargetMachine(
     llvm::CodeModel::Model codeModel, llvm::CodeGenOpt::Level codeGenOptLevel,
     bool noFramePointerElim, bool noLinkerStripDead);
 
+/**
+ * Creates a new LLVM TargetMachine with the same target triple, CPU, features
+ * and options as the given one.
+ *
+ * TargetMachines cache per-function subtarget information and must not be
+ * shared between threads; this is used to give each backend thread its own.
+ */
+llvm::TargetMachine *cloneTargetMachine(const llvm::TargetMachine &target);
+
 /**
  * Returns the Mips ABI which is used for code generation.
  *
@@ -0,0 +1,395 @@
+//===-- timetrace.cpp -----------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "driver/timetrace.h"
+
+#include "errors.h"
+#include "mars.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if LDC_POSIX
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#if __APPLE__
+#include <mach/mach.h>
+#endif
+#elif _WIN32
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+bool _TimeTrace_enabled;
+
+static llvm::cl::opt<bool, true> timeTrace(
+    "ftime-trace",
+    llvm::cl::desc("Write a Chrome trace (JSON) of the time and memory spent "
+                   "in the compiler phases, per module"),
+    llvm::cl::location(_TimeTrace_enabled), llvm::cl::ZeroOrMore);
+
+static llvm::cl::opt<unsigned> timeTraceGranularity(
+    "ftime-trace-granularity",
+    llvm::cl::desc("Minimum duration of the events recorded by -ftime-trace "
+                   "(default: 500)"),
+    llvm::cl::value_desc("microseconds"), llvm::cl::init(500),
+    llvm::cl::ZeroOrMore);
+
+static llvm::cl::opt<std::string> timeTraceFile(
+    "ftime-trace-file",
+    llvm::cl::desc("Output file of -ftime-trace (default: the -of file or "
+                   "first source file with .time-trace.json extension)"),
+    llvm::cl::value_desc("filename"), llvm::cl::ZeroOrMore);
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const Clock::time_point processStart = Clock::now();
+
+uint64_t microsecondsSinceStart(Clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(time -
+                                                               processStart)
+      .count();
+}
+
+/// Returns the peak resident set size of the process in bytes, or 0 if
+/// unknown.
+uint64_t getPeakRSS() {
+#if LDC_POSIX
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if __APPLE__
+  return usage.ru_maxrss; // bytes
+#else
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#elif _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  return 0;
+#endif
+}
+
+/// Returns the current resident set size of the process in bytes, or 0 if
+/// unknown.
+uint64_t getCurrentRSS() {
+#if __linux__
+  // Keep the file open, it's sampled twice per event.
+  static const int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+  static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+  if (fd < 0)
+    return 0;
+  char buffer[128];
+  const ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (n <= 0)
+    return 0;
+  buffer[n] = '\0';
+  unsigned long long size, resident;
+  if (sscanf(buffer, "%llu %llu", &size, &resident) != 2)
+    return 0;
+  return resident * pageSize;
+#elif __APPLE__
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+    return 0;
+  return info.resident_size;
+#elif _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.WorkingSetSize;
+#else
+  return 0;
+#endif
+}
+
+struct Event {
+  std::string name;
+  std::string detail;
+  Clock::time_point start;
+  uint64_t duration = 0; // microseconds
+  // The RSS at the start and end of the event. As it's process-wide, it
+  // includes the allocations of other threads in the meantime.
+  uint64_t startRSS = 0;
+  uint64_t endRSS = 0;
+  unsigned tid = 0;
+};
+
+struct ThreadState {
+  unsigned tid;
+  std::vector<Event> openEvents;
+};
+
+struct Total {
+  uint64_t count = 0;
+  uint64_t duration = 0; // microseconds
+};
+
+std::mutex traceMutex;
+std::map<std::thread::id, ThreadState> threads;
+std::vector<Event> events;
+llvm::StringMap<Total> totals;
+const char *traceFirstSourceFile = nullptr;
+bool traceWritten = false;
+
+ThreadState &getThreadState() {
+  auto it = threads.find(std::this_thread::get_id());
+  if (it != threads.end())
+    return it->second;
+  ThreadState &state = threads[std::this_thread::get_id()];
+  state.tid = threads.size() - 1;
+  return state;
+}
+
+void writeJSONString(llvm::raw_ostream &os, llvm::StringRef str) {
+  os << '"';
+  for (unsigned char c : str) {
+    switch (c) {
+    case '"':
+      os << "\\\"";
+      break;
+    case '\\':
+      os << "\\\\";
+      break;
+    case '\n':
+      os << "\\n";
+      break;
+    case '\t':
+      os << "\\t";
+      break;
+    default:
+      if (c < 0x20) {
+        os << llvm::format("\\u%04x", c);
+      } else {
+        os << c;
+      }
+    }
+  }
+  os << '"';
+}
+
+double toMiB(double bytes) { return bytes / (1024.0 * 1024.0); }
+
+std::string getTraceFileName(const char *firstSourceFile) {
+  if (!timeTraceFile.empty())
+    return timeTraceFile;
+
+  llvm::SmallString<128> name;
+  if (global.params.objname) {
+    name = global.params.objname;
+  } else {
+    if (global.params.objdir)
+      name = global.params.objdir;
+    llvm::sys::path::append(
+        name, llvm::sys::path::filename(firstSourceFile ? firstSourceFile
+                                                        : "ldc"));
+  }
+  llvm::sys::path::replace_extension(name, "time-trace.json");
+  return name.str().str();
+}
+}
+
+namespace TimeTrace {
+
+void begin(const char *name, const char *detail) {
+  Event event;
+  event.name = name;
+  if (detail)
+    event.detail = detail;
+  event.startRSS = getCurrentRSS();
+
+  std::lock_guard<std::mutex> lock(traceMutex);
+  ThreadState &state = getThreadState();
+  event.tid = state.tid;
+  event.start = Clock::now();
+  state.openEvents.push_back(std::move(event));
+}
+
+void end() {
+  const auto endTime = Clock::now();
+  const uint64_t endRSS = getCurrentRSS();
+
+  std::lock_guard<std::mutex> lock(traceMutex);
+  ThreadState &state = getThreadState();
+  assert(!state.openEvents.empty() && "TimeTrace::end() without begin()");
+  Event event = std::move(state.openEvents.back());
+  state.openEvents.pop_back();
+
+  event.duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(endTime -
+                                                            event.start)
+          .count();
+
+  // Sum up the time per event name, but don't count recursive events (e.g.,
+  // nested template instantiations) twice.
+  const bool isNested =
+      std::any_of(state.openEvents.begin(), state.openEvents.end(),
+                  [&](const Event &e) { return e.name == event.name; });
+  if (!isNested) {
+    Total &total = totals[event.name];
+    ++total.count;
+    total.duration += event.duration;
+  }
+
+  if (event.duration < timeTraceGranularity)
+    return;
+
+  event.endRSS = endRSS;
+  events.push_back(std::move(event));
+}
+
+void writeAtExit(const char *firstSourceFile) {
+  if (!enabled())
+    return;
+
+  traceFirstSourceFile = firstSourceFile;
+  std::atexit(write);
+}
+
+void write() {
+  std::lock_guard<std::mutex> lock(traceMutex);
+  if (traceWritten)
+    return;
+  traceWritten = true;
+
+  // When exiting via fatal(), end the events still open now.
+  const auto now = Clock::now();
+  const uint64_t nowRSS = getCurrentRSS();
+  for (auto &entry : threads) {
+    for (auto &event : entry.second.openEvents) {
+      event.duration =
+          std::chrono::duration_cast<std::chrono::microseconds>(now -
+                                                                event.start)
+              .count();
+      event.endRSS = nowRSS;
+      events.push_back(std::move(event));
+    }
+    entry.second.openEvents.clear();
+  }
+
+  const std::string filename = getTraceFileName(traceFirstSourceFile);
+  std::error_code errinfo;
+  llvm::raw_fd_ostream os(filename, errinfo, llvm::sys::fs::F_Text);
+  if (errinfo) {
+    error(Loc(), "cannot write time trace file '%s': %s", filename.c_str(),
+          errinfo.message().c_str());
+    return;
+  }
+
+  os << "{\"traceEvents\":[\n";
+
+  // Order the events by start time, as expected by some trace viewers.
+  std::stable_sort(events.begin(), events.end(),
+                   [](const Event &a, const Event &b) {
+                     return a.start < b.start;
+                   });
+
+  bool first = true;
+  const auto separate = [&] {
+    if (!first)
+      os << ",\n";
+    first = false;
+  };
+
+  for (const auto &event : events) {
+    const uint64_t ts = microsecondsSinceStart(event.start);
+    separate();
+    os << "{\"pid\":1,\"tid\":" << event.tid << ",\"ph\":\"X\",\"ts\":" << ts
+       << ",\"dur\":" << event.duration << ",\"name\":";
+    writeJSONString(os, event.name);
+    os << ",\"args\":{";
+    if (!event.detail.empty()) {
+      os << "\"detail\":";
+      writeJSONString(os, event.detail);
+    }
+    const bool hasRSS = event.startRSS && event.endRSS;
+    if (hasRSS) {
+      if (!event.detail.empty())
+        os << ",";
+      const double delta = static_cast<double>(event.endRSS) -
+                           static_cast<double>(event.startRSS);
+      os << "\"RSS delta (MiB)\":" << llvm::format("%.1f", toMiB(delta));
+    }
+    os << "}}";
+
+    // The RSS as counter track, sampled at the end of each event.
+    if (hasRSS) {
+      separate();
+      os << "{\"pid\":1,\"tid\":" << event.tid
+         << ",\"ph\":\"C\",\"ts\":" << ts + event.duration
+         << ",\"name\":\"Memory\",\"args\":{\"RSS (MiB)\":"
+         << llvm::format("%.1f", toMiB(event.endRSS)) << "}}";
+    }
+  }
+
+  // Add the total time per event name on a separate track, sorted by
+  // duration.
+  const unsigned totalsTid = threads.size();
+  std::vector<std::pair<std::string, Total>> sortedTotals;
+  for (const auto &entry : totals) {
+    sortedTotals.emplace_back(entry.getKey().str(), entry.getValue());
+  }
+  std::sort(sortedTotals.begin(), sortedTotals.end(),
+            [](const std::pair<std::string, Total> &a,
+               const std::pair<std::string, Total> &b) {
+              return a.second.duration > b.second.duration;
+            });
+  for (const auto &entry : sortedTotals) {
+    separate();
+    os << "{\"pid\":1,\"tid\":" << totalsTid
+       << ",\"ph\":\"X\",\"ts\":0,\"dur\":" << entry.second.duration
+       << ",\"name\":";
+    writeJSONString(os, "Total " + entry.first);
+    os << ",\"args\":{\"count\":" << entry.second.count
+       << ",\"avg ms\":"
+       << llvm::format("%.3f", entry.second.duration / 1000.0 /
+                                   entry.second.count)
+       << "}}";
+  }
+
+  // Name the tracks.
+  for (const auto &entry : threads) {
+    const unsigned tid = entry.second.tid;
+    separate();
+    os << "{\"pid\":1,\"tid\":" << tid
+       << ",\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":"
+       << (tid == 0 ? "\"ldc2\"" : "\"backend thread\"") << "}}";
+  }
+  separate();
+  os << "{\"pid\":1,\"tid\":" << totalsTid
+     << ",\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":"
+        "\"Totals\"}}";
+
+  os << "\n],\n\"displayTimeUnit\":\"ms\",\"peakRSS\":" << getPeakRSS()
+     << "}\n";
+}
+}
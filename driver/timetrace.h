@@ -0,0 +1,65 @@
+//===-- driver/timetrace.h - Compiler self-profiling ------------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Records the time spent in the compiler phases (parsing, semantic analysis,
+// IR generation, optimization, machine code emission, linking, ...) when
+// `-ftime-trace` is given, and writes them as Chrome trace events (JSON), to
+// be viewed in chrome://tracing or https://ui.perfetto.dev.
+//
+// The trace is thread-safe, so that the backend threads (`-j`) can record
+// their modules too. See driver/timetrace.d for the frontend interface.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_DRIVER_TIMETRACE_H
+#define LDC_DRIVER_TIMETRACE_H
+
+extern bool _TimeTrace_enabled;
+
+namespace TimeTrace {
+
+inline bool enabled() { return _TimeTrace_enabled; }
+
+/// Starts an event on the calling thread. `detail` (e.g., the module name) may
+/// be null.
+void begin(const char *name, const char *detail);
+/// Ends the innermost event started by the calling thread.
+void end();
+
+/// Makes the recorded events be written when the compiler exits (normally or
+/// via fatal()) to the `-ftime-trace-file`, by default to the `-of` file or
+/// `firstSourceFile` with the extension replaced by `.time-trace.json`.
+void writeAtExit(const char *firstSourceFile);
+/// Writes the recorded events now, see writeAtExit(). Events that are still
+/// open end now. Only the first call has an effect.
+void write();
+
+/// Records an event for its lifetime.
+class Scope {
+  bool const active_;
+
+public:
+  explicit Scope(const char *name, const char *detail = nullptr)
+      : active_(enabled()) {
+    if (active_) {
+      begin(name, detail);
+    }
+  }
+  ~Scope() {
+    if (active_) {
+      end();
+    }
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+};
+}
+
+#endif
@@ -12,6 +12,7 @@
 #include "driver/cl_options.h"
 #include "driver/cache.h"
 #include "driver/targetmachine.h"
+#include "driver/timetrace.h"
 #include "driver/tool.h"
 #include "gen/irstate.h"
 #include "gen/logger.h"
@@ -48,8 +49,11 @@
 #include "llvm/Target/TargetSubtargetInfo.h"
 #endif
 #include "llvm/IR/Module.h"
+#include <chrono>
 #include <cstddef>
+#include <cstdio>
 #include <fstream>
+#include <string>
 
 #if LDC_LLVM_VER >= 306
 using LLErrorInfo = std::error_code;
@@ -69,6 +73,9 @@ static void codegenModule(llvm::TargetMachine &Target, llvm::Module &m,
                           llvm::TargetMachine::CodeGenFileType fileType) {
   using namespace llvm;
 
+  TimeTrace::Scope timeTraceScope("Emit machine code",
+                                m.getModuleIdentifier().c_str());
+
 // Create a PassManager to hold and optimize the collection of passes we are
 // about to build.
 #if LDC_LLVM_VER >= 307
@@ -352,7 +359,8 @@ public:
   }
 };
 
-void writeObjectFile(llvm::Module *m, const char *filename) {
+bool writeObjectFile(llvm::TargetMachine &target, llvm::Module *m,
+                     const char *filename, std::string &errorMsg) {
   IF_LOG Logger::println("Writing object file to: %s", filename);
   LLErrorInfo errinfo;
   {
@@ -363,28 +371,30 @@ void writeObjectFile(llvm::Module *m, const char *filename) {
     if (errinfo.empty())
 #endif
     {
-      codegenModule(*gTargetMachine, *m, out,
-                    llvm::TargetMachine::CGFT_ObjectFile);
+      codegenModule(target, *m, out, llvm::TargetMachine::CGFT_ObjectFile);
     } else {
-      error(Loc(), "cannot write object file '%s': %s", filename,
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      errorMsg = std::string("cannot write object file '") + filename +
+                 "': " + ERRORINFO_STRING(errinfo);
+      return false;
     }
   }
-}
-
-bool shouldAssembleExternally() {
-  // There is no integrated assembler on AIX because XCOFF is not supported.
-  // Starting with LLVM 3.5 the integrated assembler can be used with MinGW.
-  return global.params.output_o &&
-         (NoIntegratedAssembler ||
-          global.params.targetTriple->getOS() == llvm::Triple::AIX);
+  return true;
 }
 
 bool shouldOutputObjectFile() {
   return global.params.output_o && !shouldAssembleExternally();
 }
 
+using Clock = std::chrono::steady_clock;
+
+/// Returns the seconds elapsed since `start`, and resets `start` to now.
+double lapSeconds(Clock::time_point &start) {
+  const auto now = Clock::now();
+  const std::chrono::duration<double> elapsed = now - start;
+  start = now;
+  return elapsed.count();
+}
+
 bool shouldDoLTO(llvm::Module *m) {
 #if LDC_LLVM_VER < 309
   return false;
@@ -401,47 +411,96 @@ bool shouldDoLTO(llvm::Module *m) {
 }
 } // end of anonymous namespace
 
-void writeModule(llvm::Module *m, const char *filename) {
+bool shouldAssembleExternally() {
+  // There is no integrated assembler on AIX because XCOFF is not supported.
+  // Starting with LLVM 3.5 the integrated assembler can be used with MinGW.
+  return global.params.output_o &&
+         (NoIntegratedAssembler ||
+          global.params.targetTriple->getOS() == llvm::Triple::AIX);
+}
+
+void writeModule(llvm::Module *m, const char *filename,
+                 ModuleWriteTimes *times) {
+  std::string errorMsg;
+  if (!writeModule(m, filename, *gTargetMachine, errorMsg, times)) {
+    error(Loc(), "%s", errorMsg.c_str());
+    fatal();
+  }
+}
+
+bool writeModule(llvm::Module *m, const char *filename,
+                 llvm::TargetMachine &target, std::string &errorMsg,
+                 ModuleWriteTimes *times, llvm::StringRef moduleBitcode) {
+  TimeTrace::Scope timeTraceScope("Write module", filename);
+  auto phaseStart = Clock::now();
+
   const bool doLTO = shouldDoLTO(m);
   const bool outputObj = shouldOutputObjectFile();
   const bool assembleExternally = shouldAssembleExternally();
 
   // Use cached object code if possible.
-  // TODO: combine LDC's cache and LTO (the advantage is skipping the IR
-  // optimization).
-  const bool useIR2ObjCache =
-      !opts::cacheDir.empty() && outputObj && !doLTO;
+  // For LTO builds, the "object file" is the optimized bitcode file (including
+  // the ThinLTO module summary), which is cached just the same; the cmdline
+  // args in the hash keep it apart from native object files.
+  const bool useIR2ObjCache = cache::isEnabled() && outputObj;
   llvm::SmallString<32> moduleHash;
   if (useIR2ObjCache) {
-    llvm::SmallString<128> cacheDir(opts::cacheDir.c_str());
-    llvm::sys::fs::make_absolute(cacheDir);
-    opts::cacheDir = cacheDir.c_str();
-
     IF_LOG Logger::println("Use IR-to-Object cache in %s",
-                           opts::cacheDir.c_str());
+                           cache::cacheLocation().c_str());
     LOG_SCOPE
 
-    cache::calculateModuleHash(m, moduleHash);
-    std::string cacheFile = cache::cacheLookup(moduleHash);
+    std::string cacheFile;
+    {
+      TimeTrace::Scope timeTraceScope("Cache lookup", filename);
+      if (!moduleBitcode.empty()) {
+        cache::calculateModuleHash(moduleBitcode, moduleHash);
+      } else {
+        cache::calculateModuleHash(m, moduleHash);
+      }
+      cacheFile = cache::cacheLookup(moduleHash);
+    }
     if (!cacheFile.empty()) {
-      cache::recoverObjectFile(moduleHash, filename);
-      return;
+      if (!cache::recoverObjectFile(moduleHash, filename, errorMsg)) {
+        return false;
+      }
+      cache::recordModuleHash(filename, moduleHash);
+      if (times) {
+        times->cacheLookup = lapSeconds(phaseStart);
+        times->cacheHit = true;
+      }
+      return true;
+    }
+    if (times) {
+      times->cacheLookup = lapSeconds(phaseStart);
     }
   }
 
   // run optimizer
-  ldc_optimize_module(m);
+  ldc_optimize_module(m, target);
+  if (!verifyModule(m, errorMsg)) {
+    return false;
+  }
+  if (times) {
+    times->optimize = lapSeconds(phaseStart);
+  }
 
   // make sure the output directory exists
   const auto directory = llvm::sys::path::parent_path(filename);
   if (!directory.empty()) {
     if (auto ec = llvm::sys::fs::create_directories(directory)) {
-      error(Loc(), "failed to create output directory: %s\n%s",
-            directory.data(), ec.message().c_str());
-      fatal();
+      errorMsg = ("failed to create output directory: " + directory + "\n" +
+                  ec.message())
+                     .str();
+      return false;
     }
   }
 
+  // An existing object file may be a hard link to a cache file (see
+  // -cache-retrieval), which must not be overwritten in place.
+  if (global.params.output_o) {
+    llvm::sys::fs::remove(filename);
+  }
+
   const auto outputFlags = {global.params.output_o, global.params.output_bc,
                             global.params.output_ll, global.params.output_s};
   const auto numOutputFiles =
@@ -464,9 +523,10 @@ void writeModule(llvm::Module *m, const char *filename) {
     LLErrorInfo errinfo;
     llvm::raw_fd_ostream bos(bcpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (bos.has_error()) {
-      error(Loc(), "cannot write LLVM bitcode file '%s': %s", bcpath.c_str(),
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      bos.clear_error();
+      errorMsg = "cannot write LLVM bitcode file '" + bcpath +
+                 "': " + ERRORINFO_STRING(errinfo);
+      return false;
     }
     if (opts::isUsingThinLTO()) {
 #if LDC_LLVM_VER >= 309
@@ -505,9 +565,10 @@ void writeModule(llvm::Module *m, const char *filename) {
     LLErrorInfo errinfo;
     llvm::raw_fd_ostream aos(llpath.c_str(), errinfo, llvm::sys::fs::F_None);
     if (aos.has_error()) {
-      error(Loc(), "cannot write LLVM IR file '%s': %s", llpath.c_str(),
-            ERRORINFO_STRING(errinfo));
-      fatal();
+      aos.clear_error();
+      errorMsg = "cannot write LLVM IR file '" + llpath +
+                 "': " + ERRORINFO_STRING(errinfo);
+      return false;
     }
     AssemblyAnnotator annotator;
     m->print(aos, &annotator);
@@ -534,15 +595,17 @@ void writeModule(llvm::Module *m, const char *filename) {
       if (errinfo.empty())
 #endif
       {
-        codegenModule(*gTargetMachine, *m, out,
+        codegenModule(target, *m, out,
                       llvm::TargetMachine::CGFT_AssemblyFile);
       } else {
-        error(Loc(), "cannot write asm: %s", ERRORINFO_STRING(errinfo));
-        fatal();
+        errorMsg =
+            std::string("cannot write asm: ") + ERRORINFO_STRING(errinfo);
+        return false;
       }
     }
 
     if (assembleExternally) {
+      // Reports errors itself; the backend threads aren't used in this case.
       assemble(spath, filename);
     }
 
@@ -552,11 +615,76 @@ void writeModule(llvm::Module *m, const char *filename) {
   }
 
   if (outputObj && !doLTO) {
-    writeObjectFile(m, filename);
+    // Write the object file straight into the cache if possible, instead of
+    // copying it there afterwards.
+    std::string cacheTempFile;
     if (useIR2ObjCache) {
-      cache::cacheObjectFile(filename, moduleHash);
+      std::string tempFileError;
+      cacheTempFile = cache::createTempObjectFile(moduleHash, tempFileError);
+      if (!tempFileError.empty()) {
+        errorMsg = tempFileError;
+        return false;
+      }
     }
+    if (!cacheTempFile.empty()) {
+      if (!writeObjectFile(target, m, cacheTempFile.c_str(), errorMsg) ||
+          !cache::commitObjectFile(cacheTempFile, moduleHash, filename,
+                                   errorMsg)) {
+        return false;
+      }
+    } else {
+      if (!writeObjectFile(target, m, filename, errorMsg)) {
+        return false;
+      }
+      if (useIR2ObjCache &&
+          !cache::cacheObjectFile(filename, moduleHash, errorMsg)) {
+        return false;
+      }
+    }
+  } else if (useIR2ObjCache) {
+    // The LTO bitcode file written above.
+    if (!cache::cacheObjectFile(filename, moduleHash, errorMsg)) {
+      return false;
+    }
+  }
+
+  if (useIR2ObjCache) {
+    cache::recordModuleHash(filename, moduleHash);
+  }
+
+  if (times) {
+    times->emit = lapSeconds(phaseStart);
+  }
+  return true;
+}
+
+void printModuleWriteTimes(const char *filename,
+                           const ModuleWriteTimes &times) {
+  const std::pair<const char *, double> stages[] = {
+      {"stall", times.stall},
+      {"serialize", times.serialize},
+      {"queued", times.queued},
+      {"deserialize", times.deserialize},
+      {times.cacheHit ? "cache hit" : "cache lookup", times.cacheLookup},
+      {"optimize", times.optimize},
+      {"emit", times.emit}};
+
+  // Format the whole line first, so that lines printed concurrently by
+  // backend threads don't interleave.
+  std::string line = "backend   ";
+  line += filename;
+  const char *separator = " (";
+  for (const auto &stage : stages) {
+    if (stage.second == 0)
+      continue;
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s%s %.1f ms", separator, stage.first,
+             stage.second * 1000);
+    line += buffer;
+    separator = ", ";
   }
+  line += separator[0] == ',' ? ")\n" : "\n";
+  fputs(line.c_str(), global.stdmsg);
 }
 
 #undef ERRORINFO_STRING
@@ -14,10 +14,55 @@
 #ifndef LDC_DRIVER_TOOBJ_H
 #define LDC_DRIVER_TOOBJ_H
 
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
 namespace llvm {
 class Module;
+class TargetMachine;
 }
 
-void writeModule(llvm::Module *m, const char *filename);
+/// Wall-clock durations (in seconds) of the stages of writing a module, for
+/// the -v output. The pipeline stages are only used by ldc::BackendPool.
+struct ModuleWriteTimes {
+  // Backend pipeline stages
+  double stall = 0; // main thread waiting for a free queue slot
+  double serialize = 0;
+  double queued = 0;
+  double deserialize = 0;
+  // writeModule() phases
+  double cacheLookup = 0;
+  double optimize = 0;
+  double emit = 0;
+  bool cacheHit = false;
+};
+
+/// Prints the non-zero stage durations as a `backend` line of the -v output.
+void printModuleWriteTimes(const char *filename, const ModuleWriteTimes &times);
+
+/// Returns true if object files are produced by an external assembler
+/// (-no-integrated-as).
+bool shouldAssembleExternally();
+
+/// Optimizes the module and writes the requested output files, using the
+/// global target machine. Errors are reported (and are fatal).
+void writeModule(llvm::Module *m, const char *filename,
+                 ModuleWriteTimes *times = nullptr);
+
+/// Like writeModule(), but optimizes and emits code using the given target
+/// machine instead of the global one, so that it can be called from several
+/// threads concurrently (given distinct modules, contexts and targets).
+/// As the frontend's error() and fatal() may only be used by the main thread,
+/// failures aren't reported; false is returned and `errorMsg` set instead.
+/// This doesn't apply to external assembly, which isn't done concurrently.
+/// If `times` is not null, the durations of the individual phases are stored
+/// there.
+/// If the caller already has a bitcode serialization of the (unoptimized)
+/// module, it can be passed as `moduleBitcode` and is then reused for the
+/// cache lookup instead of serializing the module once more.
+bool writeModule(llvm::Module *m, const char *filename,
+                 llvm::TargetMachine &target, std::string &errorMsg,
+                 ModuleWriteTimes *times = nullptr,
+                 llvm::StringRef moduleBitcode = llvm::StringRef());
 
 #endif
@@ -974,6 +974,104 @@ static LLValue *DtoArrayEqCmp_impl(Loc &loc, const char *func, DValue *l,
   return gIR->funcGen().callOrInvoke(fn, args).getInstruction();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Returns true if the elements of type t are equal iff their bytes are, so
+// that arrays of them can be compared via memcmp instead of _adEq2.
+static bool isBitwiseComparable(Type *t) {
+  t = t->toBasetype();
+  if (t->isintegral() || t->ty == Tpointer) {
+    return true;
+  }
+  if (t->ty == Tsarray) {
+    return isBitwiseComparable(t->nextOf());
+  }
+  if (t->ty == Tstruct) {
+    // Without a (generated) opEquals, TypeInfo_Struct.equals uses memcmp too.
+    StructDeclaration *sd = static_cast<TypeStruct *>(t)->sym;
+    return !needOpEquals(sd) && !sd->xeq;
+  }
+  return false;
+}
+
+// Returns the length of an array if it is known at compile time (static
+// arrays), otherwise -1.
+static dinteger_t getStaticLength(DValue *v) {
+  Type *t = v->type->toBasetype();
+  if (t->ty == Tsarray) {
+    return static_cast<TypeSArray *>(t)->dim->toUInteger();
+  }
+  return static_cast<dinteger_t>(-1);
+}
+
+// Compares two arrays of bitwise comparable elements inline: the lengths, and
+// if they match, the contents via memcmp. Small static arrays are compared by
+// loading them as single integers.
+static LLValue *DtoArrayEqualsBitwise(Loc &loc, DValue *l, DValue *r) {
+  IF_LOG Logger::println("comparing arrays bitwise");
+  LOG_SCOPE;
+
+  Type *elemType = l->type->toBasetype()->nextOf();
+  const uint64_t elemSize = getTypeAllocSize(DtoMemType(elemType));
+  const dinteger_t staticLengthL = getStaticLength(l);
+  const dinteger_t staticLengthR = getStaticLength(r);
+  const dinteger_t unknownLength = static_cast<dinteger_t>(-1);
+
+  Type *commonType = elemType->arrayOf();
+  l = DtoCastArray(loc, l, commonType);
+  r = DtoCastArray(loc, r, commonType);
+  LLValue *ptrL = DtoBitCast(DtoArrayPtr(l), getVoidPtrType());
+  LLValue *ptrR = DtoBitCast(DtoArrayPtr(r), getVoidPtrType());
+
+  if (staticLengthL != unknownLength && staticLengthR != unknownLength) {
+    if (staticLengthL != staticLengthR) {
+      return DtoConstBool(false);
+    }
+    const uint64_t size = staticLengthL * elemSize;
+    if (size == 0) {
+      return DtoConstBool(true);
+    }
+    if (size <= 16 && llvm::isPowerOf2_64(size)) {
+      LLType *intPtrTy =
+          LLIntegerType::get(gIR->context(), size * 8)->getPointerTo();
+      llvm::LoadInst *lhs = gIR->ir->CreateLoad(DtoBitCast(ptrL, intPtrTy));
+      llvm::LoadInst *rhs = gIR->ir->CreateLoad(DtoBitCast(ptrR, intPtrTy));
+      lhs->setAlignment(1);
+      rhs->setAlignment(1);
+      return gIR->ir->CreateICmpEQ(lhs, rhs);
+    }
+    LLValue *cmp = DtoMemCmp(ptrL, ptrR, DtoConstSize_t(size));
+    return gIR->ir->CreateICmpEQ(cmp, DtoConstInt(0));
+  }
+
+  // If one of the lengths is static, use it for the size to be compared, so
+  // that LLVM can expand the memcmp call.
+  LLValue *lengthL = DtoArrayLen(l);
+  LLValue *lengthR = DtoArrayLen(r);
+  LLValue *length = staticLengthL != unknownLength
+                        ? lengthL
+                        : staticLengthR != unknownLength ? lengthR : lengthL;
+
+  llvm::BasicBlock *entrybb = gIR->scopebb();
+  llvm::BasicBlock *cmpbb = gIR->insertBB("arrayeq.memcmp");
+  llvm::BasicBlock *endbb = gIR->insertBBAfter(cmpbb, "arrayeq.end");
+  llvm::BranchInst::Create(cmpbb, endbb,
+                           gIR->ir->CreateICmpEQ(lengthL, lengthR), entrybb);
+
+  gIR->scope() = IRScope(cmpbb);
+  LLValue *size = gIR->ir->CreateMul(length, DtoConstSize_t(elemSize));
+  LLValue *contentsEqual =
+      gIR->ir->CreateICmpEQ(DtoMemCmp(ptrL, ptrR, size), DtoConstInt(0));
+  cmpbb = gIR->scopebb();
+  llvm::BranchInst::Create(endbb, cmpbb);
+
+  gIR->scope() = IRScope(endbb);
+  llvm::PHINode *res =
+      gIR->ir->CreatePHI(LLType::getInt1Ty(gIR->context()), 2, "arrayeq");
+  res->addIncoming(DtoConstBool(false), entrybb);
+  res->addIncoming(contentsEqual, cmpbb);
+  return res;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 LLValue *DtoArrayEquals(Loc &loc, TOK op, DValue *l, DValue *r) {
   LLValue *res = nullptr;
@@ -982,6 +1080,11 @@ LLValue *DtoArrayEquals(Loc &loc, TOK op, DValue *l, DValue *r) {
   if (r->isNull()) {
     const auto predicate = eqTokToICmpPred(op);
     res = gIR->ir->CreateICmp(predicate, DtoArrayLen(l), DtoConstSize_t(0));
+  } else if (isBitwiseComparable(l->type->toBasetype()->nextOf())) {
+    res = DtoArrayEqualsBitwise(loc, l, r);
+    if (eqTokToICmpPred(op) == llvm::ICmpInst::ICMP_NE) {
+      res = gIR->ir->CreateNot(res);
+    }
   } else {
     res = DtoArrayEqCmp_impl(loc, "_adEq2", l, r, true);
     const auto predicate = eqTokToICmpPred(op, /* invert = */ true);
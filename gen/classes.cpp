@@ -10,9 +10,12 @@
 #include "gen/llvm.h"
 #include "aggregate.h"
 #include "declaration.h"
+#include "id.h"
 #include "init.h"
+#include "module.h"
 #include "mtype.h"
 #include "target.h"
+#include "driver/cl_options.h"
 #include "gen/arrays.h"
 #include "gen/classes.h"
 #include "gen/dvalue.h"
@@ -313,8 +316,8 @@ DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *_to) {
   LLFunctionType *funcTy = func->getFunctionType();
 
   // Object o
-  LLValue *obj = DtoRVal(val);
-  obj = DtoBitCast(obj, funcTy->getParamType(0));
+  LLValue *orig = DtoRVal(val);
+  LLValue *obj = DtoBitCast(orig, funcTy->getParamType(0));
   assert(funcTy->getParamType(0) == obj->getType());
 
   // ClassInfo c
@@ -328,9 +331,73 @@ DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *_to) {
   cinfo = DtoBitCast(cinfo, funcTy->getParamType(1));
   assert(funcTy->getParamType(1) == cinfo->getType());
 
+  // The runtime only checks whether the ClassInfo of the object (the first
+  // vtbl entry) is the target's one or derives from it. Check for the exact
+  // type inline; for final classes, that is the whole check:
+  //   o is null ? null : o.classinfo is c ? o : _d_dynamic_cast(o, c)
+  ClassDeclaration *fromSym =
+      static_cast<TypeClass *>(val->type->toBasetype())->sym;
+  const bool checkInline =
+      !to->sym->isInterfaceDeclaration() && !to->sym->isCPPclass() &&
+      !to->sym->isCOMclass() && !fromSym->isCPPclass() &&
+      !fromSym->isCOMclass();
+  const bool isFinal = (to->sym->storage_class & STCfinal) != 0;
+
+  llvm::BasicBlock *entrybb = nullptr, *checkbb = nullptr,
+                   *runtimebb = nullptr, *endbb = nullptr;
+  if (checkInline) {
+    IF_LOG Logger::println("inline ClassInfo check (%s class)",
+                           isFinal ? "final" : "non-final");
+    entrybb = gIR->scopebb();
+    checkbb = gIR->insertBB("dyncast.check");
+    if (!isFinal) {
+      runtimebb = gIR->insertBBAfter(checkbb, "dyncast.runtime");
+    }
+    endbb = gIR->insertBBAfter(isFinal ? checkbb : runtimebb, "dyncast.end");
+
+    LLValue *isNull = gIR->ir->CreateICmpEQ(
+        obj, LLConstant::getNullValue(obj->getType()), ".nullcheck");
+    llvm::BranchInst::Create(endbb, checkbb, isNull, gIR->scopebb());
+
+    gIR->scope() = IRScope(checkbb);
+    LLValue *vtbl = DtoLoad(DtoGEPi(orig, 0, 0), ".vtbl");
+    LLValue *classInfo = DtoLoad(DtoGEPi(vtbl, 0, 0), ".classinfo");
+    LLValue *isExact = gIR->ir->CreateICmpEQ(
+        DtoBitCast(classInfo, cinfo->getType()), cinfo, ".isExact");
+    checkbb = gIR->scopebb();
+
+    if (isFinal) {
+      // No subclasses, so a different ClassInfo means a failed cast.
+      LLValue *ret = gIR->ir->CreateSelect(
+          isExact, obj, LLConstant::getNullValue(obj->getType()));
+      llvm::BranchInst::Create(endbb, gIR->scopebb());
+      gIR->scope() = IRScope(endbb);
+
+      llvm::PHINode *phi = gIR->ir->CreatePHI(obj->getType(), 2, ".dyncast");
+      phi->addIncoming(LLConstant::getNullValue(obj->getType()), entrybb);
+      phi->addIncoming(ret, checkbb);
+      return new DImValue(_to, DtoBitCast(phi, DtoType(_to)));
+    }
+
+    llvm::BranchInst::Create(endbb, runtimebb, isExact, gIR->scopebb());
+    gIR->scope() = IRScope(runtimebb);
+  }
+
   // call it
   LLValue *ret = gIR->CreateCallOrInvoke(func, obj, cinfo).getInstruction();
 
+  if (checkInline) {
+    runtimebb = gIR->scopebb();
+    llvm::BranchInst::Create(endbb, gIR->scopebb());
+    gIR->scope() = IRScope(endbb);
+
+    llvm::PHINode *phi = gIR->ir->CreatePHI(obj->getType(), 3, ".dyncast");
+    phi->addIncoming(LLConstant::getNullValue(obj->getType()), entrybb);
+    phi->addIncoming(obj, checkbb);
+    phi->addIncoming(ret, runtimebb);
+    ret = phi;
+  }
+
   // cast return value
   ret = DtoBitCast(ret, DtoType(_to));
 
@@ -374,6 +441,62 @@ DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *_to) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+#if LDC_LLVM_VER >= 400
+namespace {
+/// Returns true if the class is part of druntime or Phobos. Their vtbls are
+/// precompiled without !type metadata, so calls through these classes must not
+/// be devirtualized.
+bool isDefinedInRuntimeLibrary(ClassDeclaration *cd) {
+  ModuleDeclaration *md = cd->getModule()->md;
+  if (!md) {
+    return false;
+  }
+  if (!md->packages || md->packages->dim == 0) {
+    return md->id == Id::object;
+  }
+  const char *root = (*md->packages)[0]->toChars();
+  return !strcmp(root, "core") || !strcmp(root, "std") ||
+         !strcmp(root, "etc") || !strcmp(root, "ldc");
+}
+
+/// Returns the type identifier of the given class for the vtbl !type metadata
+/// and llvm.type.test, or null if calls through the class must not be
+/// devirtualized.
+///
+/// Interfaces are deliberately excluded. A call through an interface loads
+/// one of the interface vtbls built by IrAggr::getInterfaceVtbl() for each
+/// implementing class, not the class vtbl annotated by
+/// DtoAddVtblTypeMetadata(). Each of them would need the type IDs of the
+/// interface and of all interfaces it extends (whose vtbls are prefixes of
+/// its own), for every implementing class. Any vtbl missing an ID would make
+/// the llvm.type.test fail for a valid object, and the following llvm.assume
+/// would turn the call into undefined behavior.
+llvm::MDString *getVtblTypeId(ClassDeclaration *cd) {
+  if (!opts::isUsingWholeProgramVtables() || cd->isInterfaceDeclaration() ||
+      cd->isCPPclass() || cd->isCOMclass() || isDefinedInRuntimeLibrary(cd)) {
+    return nullptr;
+  }
+  std::string id = "_D";
+  id += mangle(cd);
+  return llvm::MDString::get(gIR->context(), id);
+}
+}
+#endif
+
+void DtoAddVtblTypeMetadata(ClassDeclaration *cd, llvm::GlobalVariable *vtbl) {
+#if LDC_LLVM_VER >= 400
+  // The vtbl of a class starts with the vtbl of each base class, so it is
+  // compatible with all of them at offset 0 (the address stored in objects).
+  for (ClassDeclaration *c = cd; c; c = c->baseClass) {
+    if (llvm::MDString *typeId = getVtblTypeId(c)) {
+      vtbl->addTypeMetadata(0, typeId);
+    }
+  }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 LLValue *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
                                    const char *name) {
   // sanity checks
@@ -393,6 +516,22 @@ LLValue *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
   funcval = DtoGEPi(funcval, 0, 0);
   // load vtbl ptr
   funcval = DtoLoad(funcval);
+
+#if LDC_LLVM_VER >= 400
+  // Tell LLVM that the vtbl belongs to the static type's class hierarchy, so
+  // that whole-program devirtualization can replace the call if there is a
+  // single implementation.
+  ClassDeclaration *cd =
+      static_cast<TypeClass *>(inst->type->toBasetype())->sym;
+  if (llvm::MDString *typeId = getVtblTypeId(cd)) {
+    LLValue *typeTest = gIR->ir->CreateCall(
+        GET_INTRINSIC_DECL(type_test),
+        {DtoBitCast(funcval, getVoidPtrType()),
+         llvm::MetadataAsValue::get(gIR->context(), typeId)},
+        ".typeTest");
+    gIR->ir->CreateCall(GET_INTRINSIC_DECL(assume), typeTest);
+  }
+#endif
   // index vtbl
   std::string vtblname = name;
   vtblname.append("@vtbl");
@@ -39,6 +39,10 @@ DValue *DtoDynamicCastObject(Loc &loc, DValue *val, Type *to);
 
 DValue *DtoDynamicCastInterface(Loc &loc, DValue *val, Type *to);
 
+/// Adds the !type metadata for whole-program devirtualization
+/// (-fwhole-program-vtables) to the vtbl of the given class.
+void DtoAddVtblTypeMetadata(ClassDeclaration *cd, llvm::GlobalVariable *vtbl);
+
 llvm::Value *DtoVirtualFunctionPointer(DValue *inst, FuncDeclaration *fdecl,
                                        const char *name);
 
@@ -261,6 +261,7 @@ public:
       llvm::GlobalVariable *vtbl = ir->getVtblSymbol();
       vtbl->setInitializer(ir->getVtblInit());
       setLinkage(lwc, vtbl);
+      DtoAddVtblTypeMetadata(decl, vtbl);
 
       llvm::GlobalVariable *classZ = ir->getClassInfoSymbol();
       classZ->setInitializer(ir->getClassInfoInit());
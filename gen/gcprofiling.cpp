@@ -0,0 +1,366 @@
+//===-- gcprofiling.cpp ---------------------------------------------------===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gen/gcprofiling.h"
+
+#include "module.h"
+#include "gen/irstate.h"
+#include "gen/llvm.h"
+#include "gen/llvmhelpers.h"
+#include "gen/logger.h"
+#include "gen/metadata.h"
+#include "gen/runtime.h"
+#include "gen/tollvm.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#if LDC_LLVM_VER >= 307
+#include "llvm/IR/DebugInfoMetadata.h"
+#endif
+
+static llvm::cl::opt<bool> profileGCAllocs(
+    "fprofile-gc-allocs",
+    llvm::cl::desc("Count the GC allocations and requested bytes per call "
+                   "site; the profile is written to gcprof.txt (or "
+                   "$LDC_GCPROF_FILE) at program exit (use -g or "
+                   "-gline-tables-only for source locations)"),
+    llvm::cl::ZeroOrMore);
+
+bool isProfilingGCAllocations() { return profileGCAllocs; }
+
+namespace {
+/// How the number of requested bytes is derived from the arguments of an
+/// allocation function.
+enum class SizeKind {
+  /// Not known.
+  None,
+  /// The argument is the size in bytes.
+  Bytes,
+  /// The argument is a TypeInfo; the size of the type is allocated.
+  TypeSize,
+  /// The first argument is the TypeInfo of an array, the given argument the
+  /// number of elements.
+  ArrayLength,
+  /// The first argument is the TypeInfo of an array, the given argument a
+  /// slice whose elements are allocated.
+  ArraySlice,
+  /// The argument is a ClassInfo; the size of the class instance is
+  /// allocated.
+  ClassSize
+};
+
+struct AllocFunction {
+  SizeKind kind;
+  unsigned argIdx;
+};
+
+AllocFunction getAllocFunction(llvm::StringRef name) {
+  using K = SizeKind;
+  return llvm::StringSwitch<AllocFunction>(name)
+      .Case("_d_allocmemory", {K::Bytes, 0})
+      .Case("_d_allocmemoryT", {K::TypeSize, 0})
+      .Cases("_d_newitemT", "_d_newitemiT", {K::TypeSize, 0})
+      .Cases("_d_newarrayT", "_d_newarrayiT", "_d_newarrayU",
+             {K::ArrayLength, 1})
+      .Cases("_d_newarraymTX", "_d_newarraymiTX", {K::None, 0})
+      .Cases("_d_newclass", "_d_allocclass", {K::ClassSize, 0})
+      .Case("_d_arrayappendcTX", {K::ArrayLength, 2})
+      .Case("_d_arrayappendT", {K::ArraySlice, 2})
+      .Cases("_d_arrayappendcd", "_d_arrayappendwd", {K::None, 0})
+      .Cases("_d_arraysetlengthT", "_d_arraysetlengthiT", {K::ArrayLength, 1})
+      .Cases("_d_arraycatT", "_d_arraycatnTX", {K::None, 0})
+      .Case("_d_assocarrayliteralTX", {K::None, 0})
+      .Default({K::None, ~0u});
+}
+
+/// Returns the value of the given field of the named metadata describing a
+/// TypeInfo or ClassInfo global (see gen/metadata.h), or null.
+llvm::Constant *getInfoMetadata(const char *prefix, llvm::Value *info,
+                                unsigned numFields, unsigned field) {
+  auto global = llvm::dyn_cast<llvm::GlobalVariable>(info->stripPointerCasts());
+  if (!global) {
+    return nullptr;
+  }
+  llvm::NamedMDNode *meta =
+      gIR->module.getNamedMetadata(prefix + global->getName().str());
+  if (!meta || meta->getNumOperands() == 0) {
+    return nullptr;
+  }
+  llvm::MDNode *node = meta->getOperand(0);
+  if (!node || node->getNumOperands() != numFields) {
+    return nullptr;
+  }
+#if LDC_LLVM_VER >= 306
+  return llvm::mdconst::dyn_extract<llvm::Constant>(node->getOperand(field));
+#else
+  return llvm::dyn_cast<llvm::Constant>(node->getOperand(field));
+#endif
+}
+
+/// Returns the allocation size of the D type described by the given TypeInfo,
+/// or 0 if unknown.
+uint64_t getTypeInfoSize(llvm::Value *typeInfo) {
+  llvm::Constant *type =
+      getInfoMetadata(TD_PREFIX, typeInfo, TD_NumFields, TD_Type);
+  return type ? getTypeAllocSize(type->getType()) : 0;
+}
+
+/// Returns the element size of the array type described by the given
+/// TypeInfo, or 0 if unknown.
+uint64_t getArrayTypeInfoElementSize(llvm::Value *typeInfo) {
+  llvm::Constant *type =
+      getInfoMetadata(TD_PREFIX, typeInfo, TD_NumFields, TD_Type);
+  auto arrayType = type ? llvm::dyn_cast<llvm::StructType>(type->getType())
+                        : nullptr;
+  if (!arrayType || arrayType->getNumElements() != 2 ||
+      !arrayType->getElementType(1)->isPointerTy()) {
+    return 0;
+  }
+  LLType *elemType = arrayType->getElementType(1)->getPointerElementType();
+  return elemType->isSized() ? getTypeAllocSize(elemType) : 0;
+}
+
+/// Computes the number of bytes requested by the given allocation call, as
+/// i64 value inserted before the call, or returns null if unknown.
+LLValue *getRequestedBytes(llvm::IRBuilder<> &builder, llvm::CallSite call,
+                           const AllocFunction &fn) {
+  LLType *i64 = builder.getInt64Ty();
+  if (fn.kind == SizeKind::None || fn.argIdx >= call.arg_size()) {
+    return nullptr;
+  }
+  LLValue *arg = call.getArgument(fn.argIdx);
+
+  switch (fn.kind) {
+  case SizeKind::None:
+    return nullptr;
+  case SizeKind::Bytes:
+    return builder.CreateZExtOrTrunc(arg, i64);
+  case SizeKind::TypeSize: {
+    const uint64_t size = getTypeInfoSize(arg);
+    return size ? llvm::ConstantInt::get(i64, size) : nullptr;
+  }
+  case SizeKind::ArrayLength:
+  case SizeKind::ArraySlice: {
+    const uint64_t elemSize =
+        getArrayTypeInfoElementSize(call.getArgument(0));
+    if (!elemSize) {
+      return nullptr;
+    }
+    LLValue *length = arg;
+    if (fn.kind == SizeKind::ArraySlice) {
+      length = builder.CreateExtractValue(arg, 0);
+    }
+    return builder.CreateMul(builder.CreateZExtOrTrunc(length, i64),
+                             llvm::ConstantInt::get(i64, elemSize));
+  }
+  case SizeKind::ClassSize: {
+    llvm::Constant *body =
+        getInfoMetadata(CD_PREFIX, arg, CD_NumFields, CD_BodyType);
+    return body ? llvm::ConstantInt::get(i64, getTypeAllocSize(body->getType()))
+                : nullptr;
+  }
+  }
+  llvm_unreachable("Unknown allocation size kind.");
+}
+
+struct Site {
+  llvm::Instruction *call;
+  AllocFunction fn;
+};
+
+/// Returns the metadata identifying the counter of the given site, attached to
+/// the allocation call and to the increments of its counter.
+llvm::MDNode *getSiteMetadata(llvm::LLVMContext &context,
+                              llvm::GlobalVariable *counters, unsigned idx) {
+#if LDC_LLVM_VER >= 306
+  llvm::Metadata *ops[] = {llvm::ConstantAsMetadata::get(counters),
+                           llvm::ConstantAsMetadata::get(DtoConstUint(idx))};
+#else
+  llvm::Value *ops[] = {counters, DtoConstUint(idx)};
+#endif
+  return llvm::MDNode::get(context, ops);
+}
+}
+
+void addGCAllocationProfiling(Module *m) {
+  if (!profileGCAllocs) {
+    return;
+  }
+
+  IF_LOG Logger::println("Adding GC allocation profiling for module %s",
+                         m->toChars());
+  LOG_SCOPE;
+
+  llvm::Module &module = gIR->module;
+  llvm::LLVMContext &context = gIR->context();
+
+  // Collect the call sites first, as the instrumentation adds instructions.
+  // With -singleobj, the LLVM module already contains the code of the
+  // previous D modules, whose calls are marked as instrumented.
+  const unsigned instrumentedKind = context.getMDKindID("ldc.gcprof");
+  const unsigned counterKind = context.getMDKindID("ldc.gcprof.counter");
+  std::vector<Site> sites;
+  for (auto &fn : module) {
+    for (auto &bb : fn) {
+      for (auto &inst : bb) {
+        llvm::CallSite call(&inst);
+        if (!call.getInstruction() || inst.getMetadata(instrumentedKind)) {
+          continue;
+        }
+        llvm::Function *callee = call.getCalledFunction();
+        if (!callee || !callee->isDeclaration()) {
+          continue;
+        }
+        const AllocFunction allocFn = getAllocFunction(callee->getName());
+        if (allocFn.argIdx != ~0u) {
+          sites.push_back({&inst, allocFn});
+        }
+      }
+    }
+  }
+
+  if (sites.empty()) {
+    return;
+  }
+
+  IF_LOG Logger::println("%llu allocation sites",
+                         static_cast<unsigned long long>(sites.size()));
+
+  // struct { ulong count; ulong bytes; }[# sites] _d_gcprof_counters
+  LLType *i64 = LLType::getInt64Ty(context);
+  LLStructType *counterType = LLStructType::get(context, {i64, i64});
+  LLArrayType *countersType = LLArrayType::get(counterType, sites.size());
+  auto counters = new llvm::GlobalVariable(
+      module, countersType, false, LLGlobalValue::InternalLinkage,
+      llvm::ConstantAggregateZero::get(countersType), "_d_gcprof_counters");
+
+  // struct { string file; uint line; uint column; string function;
+  //          string callee; }[# sites] _d_gcprof_sites
+  LLType *stringType = DtoType(Type::tstring);
+  LLType *i32 = LLType::getInt32Ty(context);
+  LLStructType *siteType = LLStructType::get(
+      context, {stringType, i32, i32, stringType, stringType});
+  std::vector<LLConstant *> siteInits;
+  siteInits.reserve(sites.size());
+
+  for (size_t i = 0; i < sites.size(); ++i) {
+    llvm::Instruction *inst = sites[i].call;
+    llvm::CallSite call(inst);
+
+    std::string file = m->srcfile->name->toChars();
+    unsigned line = 0, column = 0;
+#if LDC_LLVM_VER >= 307
+    if (const llvm::DILocation *loc = inst->getDebugLoc().get()) {
+      file = loc->getFilename().str();
+      line = loc->getLine();
+      column = loc->getColumn();
+    }
+#endif
+    LLConstant *fields[] = {
+        DtoConstString(file.c_str()), DtoConstUint(line), DtoConstUint(column),
+        DtoConstString(inst->getParent()->getParent()->getName().str().c_str()),
+        DtoConstString(call.getCalledFunction()->getName().str().c_str())};
+    siteInits.push_back(llvm::ConstantStruct::get(siteType, fields));
+
+    // Count the allocation and the requested bytes. The increments are atomic
+    // so that this works when multiple threads are executed.
+    llvm::MDNode *siteMeta = getSiteMetadata(context, counters, i);
+    inst->setMetadata(instrumentedKind, siteMeta);
+    llvm::IRBuilder<> builder(inst);
+    const auto ordering =
+#if LDC_LLVM_VER >= 309
+        llvm::AtomicOrdering::Monotonic;
+#else
+        llvm::Monotonic;
+#endif
+    LLConstant *countIdxs[] = {DtoConstUint(0), DtoConstUint(i),
+                               DtoConstUint(0)};
+    builder
+        .CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+                         llvm::ConstantExpr::getGetElementPtr(
+#if LDC_LLVM_VER >= 307
+                             countersType,
+#endif
+                             counters, countIdxs, true),
+                         llvm::ConstantInt::get(i64, 1), ordering)
+        ->setMetadata(counterKind, siteMeta);
+    if (LLValue *bytes = getRequestedBytes(builder, call, sites[i].fn)) {
+      LLConstant *bytesIdxs[] = {DtoConstUint(0), DtoConstUint(i),
+                                 DtoConstUint(1)};
+      builder
+          .CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+                           llvm::ConstantExpr::getGetElementPtr(
+#if LDC_LLVM_VER >= 307
+                               countersType,
+#endif
+                               counters, bytesIdxs, true),
+                           bytes, ordering)
+          ->setMetadata(counterKind, siteMeta);
+    }
+  }
+
+  LLArrayType *sitesType = LLArrayType::get(siteType, sites.size());
+  auto sitesTable = new llvm::GlobalVariable(
+      module, sitesType, true, LLGlobalValue::InternalLinkage,
+      llvm::ConstantArray::get(sitesType, siteInits), "_d_gcprof_sites");
+
+  // Register the counters with profile-rt before any D code runs, calling
+  // _d_gcprof_register(const(GCProfSite)* sites, GCProfCounter* counters,
+  //                    size_t length)
+  std::string ctorName = "ldc.gcprof_ctor.";
+  ctorName += mangle(m);
+  auto ctor = LLFunction::Create(
+      LLFunctionType::get(LLType::getVoidTy(context), false),
+      LLGlobalValue::InternalLinkage, ctorName, &module);
+  {
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "", ctor));
+    LLFunction *registerFn =
+        getRuntimeFunction(Loc(), module, "_d_gcprof_register");
+    LLValue *args[] = {
+        DtoBitCast(sitesTable, registerFn->getFunctionType()->getParamType(0)),
+        DtoBitCast(counters, registerFn->getFunctionType()->getParamType(1)),
+        DtoConstSize_t(sites.size())};
+    builder.CreateCall(registerFn, args);
+    builder.CreateRetVoid();
+  }
+  llvm::appendToGlobalCtors(module, ctor, 65535);
+}
+
+void removeDeadGCAllocationCounters(llvm::Module &module) {
+  if (!profileGCAllocs) {
+    return;
+  }
+
+  // The optimizer may have removed allocation calls (e.g. promoted them to
+  // stack allocations), so drop the increments of their counters; the sites
+  // of counters that stay zero aren't written to the profile.
+  llvm::LLVMContext &context = module.getContext();
+  const unsigned instrumentedKind = context.getMDKindID("ldc.gcprof");
+  const unsigned counterKind = context.getMDKindID("ldc.gcprof.counter");
+  llvm::SmallPtrSet<llvm::MDNode *, 32> liveSites;
+  std::vector<llvm::Instruction *> increments;
+  for (auto &fn : module) {
+    for (auto &bb : fn) {
+      for (auto &inst : bb) {
+        if (llvm::MDNode *site = inst.getMetadata(instrumentedKind)) {
+          liveSites.insert(site);
+        } else if (inst.getMetadata(counterKind)) {
+          increments.push_back(&inst);
+        }
+      }
+    }
+  }
+
+  for (llvm::Instruction *inst : increments) {
+    if (!liveSites.count(inst->getMetadata(counterKind))) {
+      inst->eraseFromParent();
+    }
+  }
+}
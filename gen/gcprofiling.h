@@ -0,0 +1,36 @@
+//===-- gen/gcprofiling.h - GC allocation site profiling --------*- C++ -*-===//
+//
+//                         LDC – the LLVM D compiler
+//
+// This file is distributed under the BSD-style LDC license. See the LICENSE
+// file for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Instruments the calls to druntime's GC allocation functions when
+// "-fprofile-gc-allocs" is given: each call site gets a counter for the number
+// of allocations and the number of requested bytes. The counters are
+// registered with profile-rt (ldc.gcprofile), which writes them to a profile
+// at program exit.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LDC_GEN_GCPROFILING_H
+#define LDC_GEN_GCPROFILING_H
+
+class Module;
+namespace llvm {
+class Module;
+}
+
+bool isProfilingGCAllocations();
+
+/// Instruments all GC allocation calls in the IR of the current module.
+/// Call after the module's members have been generated.
+void addGCAllocationProfiling(Module *m);
+
+/// Removes the counter increments of the instrumented allocation calls that
+/// have been optimized away. Call after optimizing the module.
+void removeDeadGCAllocationCounters(llvm::Module &module);
+
+#endif
@@ -1720,19 +1720,22 @@ llvm::GlobalVariable *getOrCreateGlobal(const Loc &loc, llvm::Module &module,
     return existing;
   }
 
-  // Use a command line option for the thread model.
-  // On PPC there is only local-exec available - in this case just ignore the
-  // command line.
   const llvm::GlobalVariable::ThreadLocalMode tlsModel =
-      isThreadLocal
-          ? (global.params.targetTriple->getArch() == llvm::Triple::ppc
-                 ? llvm::GlobalVariable::LocalExecTLSModel
-                 : clThreadModel.getValue())
-          : llvm::GlobalVariable::NotThreadLocal;
+      isThreadLocal ? getThreadLocalMode()
+                    : llvm::GlobalVariable::NotThreadLocal;
   return new llvm::GlobalVariable(module, type, isConstant, linkage, init, name,
                                   nullptr, tlsModel);
 }
 
+llvm::GlobalVariable::ThreadLocalMode getThreadLocalMode() {
+  // Use a command line option for the thread model.
+  // On PPC there is only local-exec available - in this case just ignore the
+  // command line.
+  return global.params.targetTriple->getArch() == llvm::Triple::ppc
+             ? llvm::GlobalVariable::LocalExecTLSModel
+             : clThreadModel.getValue();
+}
+
 FuncDeclaration *getParentFunc(Dsymbol *sym) {
   if (!sym) {
     return nullptr;
@@ -260,6 +260,9 @@ llvm::GlobalVariable *getOrCreateGlobal(const Loc &loc, llvm::Module &module,
                                         llvm::StringRef name,
                                         bool isThreadLocal = false);
 
+/// Returns the TLS model for thread-local globals (see -fthread-model).
+llvm::GlobalVariable::ThreadLocalMode getThreadLocalMode();
+
 FuncDeclaration *getParentFunc(Dsymbol *sym);
 
 void Declaration_codegen(Dsymbol *decl);
@@ -25,6 +25,7 @@
 #include "gen/abi.h"
 #include "gen/arrays.h"
 #include "gen/functions.h"
+#include "gen/gcprofiling.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
@@ -721,6 +722,10 @@ void codegenModule(IRState *irs, Module *m) {
     fatal();
   }
 
+  if (isProfilingGCAllocations() && !isPseudoModule) {
+    addGCAllocationProfiling(m);
+  }
+
   // Skip emission of all the additional module metadata if requested by the
   // user or the betterC switch is on.
   if (!global.params.betterC && !m->noModuleInfo) {
@@ -9,7 +9,9 @@
 
 #include "gen/optimizer.h"
 #include "errors.h"
+#include "driver/timetrace.h"
 #include "gen/cl_helpers.h"
+#include "gen/gcprofiling.h"
 #include "gen/logger.h"
 #include "gen/passes/Passes.h"
 #include "llvm/LinkAllPasses.h"
@@ -37,7 +39,6 @@
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
-extern llvm::TargetMachine *gTargetMachine;
 using namespace llvm;
 
 static cl::opt<signed char> optimizeLevel(
@@ -343,7 +344,7 @@ static void addOptimizationPasses(PassManagerBase &mpm,
 ////////////////////////////////////////////////////////////////////////////////
 // This function runs optimization passes based on command line arguments.
 // Returns true if any optimization passes were invoked.
-bool ldc_optimize_module(llvm::Module *M) {
+bool ldc_optimize_module(llvm::Module *M, llvm::TargetMachine &target) {
 // Create a PassManager to hold and optimize the collection of
 // per-module passes we are about to build.
 #if LDC_LLVM_VER >= 307
@@ -390,11 +391,11 @@ bool ldc_optimize_module(llvm::Module *M) {
 
 #if LDC_LLVM_VER >= 307
   // Add internal analysis passes from the target machine.
-  mpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+  mpm.add(
+      createTargetTransformInfoWrapperPass(target.getTargetIRAnalysis()));
 #else
   // Add internal analysis passes from the target machine.
-  gTargetMachine->addAnalysisPasses(mpm);
+  target.addAnalysisPasses(mpm);
 #endif
 
 // Also set up a manager for the per-function passes.
@@ -405,14 +406,14 @@ bool ldc_optimize_module(llvm::Module *M) {
 
 #if LDC_LLVM_VER >= 307
   // Add internal analysis passes from the target machine.
-  fpm.add(createTargetTransformInfoWrapperPass(
-      gTargetMachine->getTargetIRAnalysis()));
+  fpm.add(
+      createTargetTransformInfoWrapperPass(target.getTargetIRAnalysis()));
 #elif LDC_LLVM_VER >= 306
   fpm.add(new DataLayoutPass());
-  gTargetMachine->addAnalysisPasses(fpm);
+  target.addAnalysisPasses(fpm);
 #else
                                     fpm.add(new DataLayoutPass(M));
-                                    gTargetMachine->addAnalysisPasses(fpm);
+                                    target.addAnalysisPasses(fpm);
 #endif
 
   // If the -strip-debug command line option was specified, add it before
@@ -424,35 +425,43 @@ bool ldc_optimize_module(llvm::Module *M) {
   addOptimizationPasses(mpm, fpm, optLevel(), sizeLevel());
 
   // Run per-function passes.
-  fpm.doInitialization();
-  for (auto &F : *M) {
-    fpm.run(F);
+  {
+    TimeTrace::Scope timeTraceScope("Optimize function passes",
+                                  M->getModuleIdentifier().c_str());
+    fpm.doInitialization();
+    for (auto &F : *M) {
+      fpm.run(F);
+    }
+    fpm.doFinalization();
   }
-  fpm.doFinalization();
 
   // Run per-module passes.
-  mpm.run(*M);
-
-  // Verify the resulting module.
-  if (!noVerify) {
-    verifyModule(M);
+  {
+    TimeTrace::Scope timeTraceScope("Optimize module passes",
+                                  M->getModuleIdentifier().c_str());
+    mpm.run(*M);
   }
 
+  removeDeadGCAllocationCounters(*M);
+
   // Report that we run some passes.
   return true;
 }
 
-// Verifies the module.
-void verifyModule(llvm::Module *m) {
+// Verifies the module, unless disabled by -disable-verify.
+bool verifyModule(llvm::Module *m, std::string &errorMsg) {
+  if (noVerify) {
+    return true;
+  }
   Logger::println("Verifying module...");
   LOG_SCOPE;
-  std::string ErrorStr;
-  raw_string_ostream OS(ErrorStr);
+  raw_string_ostream OS(errorMsg);
   if (llvm::verifyModule(*m, &OS)) {
-    error(Loc(), "%s", ErrorStr.c_str());
-    fatal();
+    OS.flush();
+    return false;
   }
   Logger::println("Verification passed!");
+  return true;
 }
 
 // Output to `hash_os` all optimization settings that influence object code output
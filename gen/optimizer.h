@@ -38,9 +38,10 @@ extern llvm::cl::opt<SanitizerCheck> sanitize;
 
 namespace llvm {
 class Module;
+class TargetMachine;
 }
 
-bool ldc_optimize_module(llvm::Module *m);
+bool ldc_optimize_module(llvm::Module *m, llvm::TargetMachine &target);
 
 // Returns whether the normal, full inlining pass will be run.
 bool willInline();
@@ -53,7 +54,9 @@ bool isOptimizationEnabled();
 
 llvm::CodeGenOpt::Level codeGenOptLevel();
 
-void verifyModule(llvm::Module *m);
+/// Verifies the (optimized) module, unless disabled by -disable-verify.
+/// Returns false and sets `errorMsg` if it is broken.
+bool verifyModule(llvm::Module *m, std::string &errorMsg);
 
 void outputOptimizationSettings(llvm::raw_ostream &hash_os);
 
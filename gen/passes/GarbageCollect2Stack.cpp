@@ -27,20 +27,27 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/CallSite.h"
+#if LDC_LLVM_VER >= 307
+#include "llvm/IR/DebugInfoMetadata.h"
+#endif
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include <algorithm>
+#include <mutex>
+#include <string>
 
 using namespace llvm;
 
@@ -55,6 +62,17 @@ static cl::opt<unsigned>
               cl::desc("Require allocs to be smaller than n bytes to be "
                        "promoted, 0 to ignore."));
 
+static cl::opt<std::string> ReportFile(
+    "dgc2stack-report", cl::value_desc("filename"),
+    cl::desc("Write a YAML report listing all GC allocations seen by the "
+             "GC-to-stack promotion and why they were (not) promoted "
+             "(compile with -g for source locations)"));
+
+static cl::opt<unsigned> CallDepthLimit(
+    "dgc2stack-call-depth", cl::init(3), cl::Hidden,
+    cl::desc("Maximum depth of calls to functions defined in the module to "
+             "follow when checking whether an allocation escapes."));
+
 namespace {
 struct Analysis {
   const DataLayout &DL;
@@ -92,6 +110,22 @@ static void EmitMemZero(IRBuilder<> &B, Value *Dst, Value *Len,
 //===----------------------------------------------------------------------===//
 
 namespace {
+/// What happened to a GC allocation, for -dgc2stack-report.
+namespace Outcome {
+enum Type {
+  Promoted,
+  Deleted,
+  UnknownType,
+  SizeLimit,
+  HasDestructor,
+  EscapesViaStore,
+  EscapesViaCall,
+  EscapesViaReturn,
+  EscapesOther,
+  ReallocHazard
+};
+}
+
 namespace ReturnType {
 enum Type {
   Pointer, /// Function returns a pointer to the allocated memory.
@@ -106,6 +140,9 @@ protected:
 public:
   ReturnType::Type ReturnType;
 
+  // Set by analyze() if it returns false.
+  Outcome::Type Failure = Outcome::UnknownType;
+
   // Analyze the current call, filling in some fields. Returns true if
   // this is an allocation we can stack-allocate.
   virtual bool analyze(CallSite CS, const Analysis &A) = 0;
@@ -164,8 +201,10 @@ public:
     Value *TypeInfo = CS.getArgument(TypeInfoArgNr);
     Ty = A.getTypeFor(TypeInfo);
     if (!Ty) {
+      Failure = Outcome::UnknownType;
       return false;
     }
+    Failure = Outcome::SizeLimit;
     return A.DL.getTypeAllocSize(Ty) < SizeLimit;
   }
 };
@@ -203,6 +242,7 @@ public:
     if (SizeLimit > 0) {
       uint64_t ElemSize = A.DL.getTypeAllocSize(Ty);
       if (!isKnownLessThan(arrSize, SizeLimit / ElemSize, A)) {
+        Failure = Outcome::SizeLimit;
         return false;
       }
     }
@@ -259,6 +299,7 @@ public:
 class AllocClassFI : public FunctionInfo {
 public:
   bool analyze(CallSite CS, const Analysis &A) override {
+    Failure = Outcome::UnknownType;
     if (CS.arg_size() != 1) {
       return false;
     }
@@ -305,6 +346,7 @@ public:
 
     if (ConstantExpr::getOr(hasDestructor, hasCustomDelete) !=
         ConstantInt::getFalse(A.M.getContext())) {
+      Failure = Outcome::HasDestructor;
       return false;
     }
 
@@ -314,6 +356,7 @@ public:
 #else
     Ty = node->getOperand(CD_BodyType)->getType();
 #endif
+    Failure = Outcome::SizeLimit;
     return A.DL.getTypeAllocSize(Ty) < SizeLimit;
   }
 
@@ -331,6 +374,7 @@ class UntypedMemoryFI : public FunctionInfo {
 public:
   bool analyze(CallSite CS, const Analysis &A) override {
     if (CS.arg_size() < SizeArgNr + 1) {
+      Failure = Outcome::UnknownType;
       return false;
     }
 
@@ -343,6 +387,7 @@ public:
     // is useful for experimenting.
     if (SizeLimit > 0) {
       if (!isKnownLessThan(SizeArg, SizeLimit, A)) {
+        Failure = Outcome::SizeLimit;
         return false;
       }
     }
@@ -382,6 +427,225 @@ public:
 };
 }
 
+//===----------------------------------------------------------------------===//
+// Interprocedural escape analysis
+//===----------------------------------------------------------------------===//
+
+namespace {
+/// Checks whether pointers passed to functions defined in the current module
+/// (and not marked 'nocapture') are captured by them, following calls up to
+/// -dgc2stack-call-depth levels deep.
+///
+/// Delegates are tracked too: if a pointer is used as the context of a
+/// delegate whose function is known, the delegate may be passed around freely
+/// as long as it is only called (calling the known function with the context)
+/// or passed to other non-capturing functions. This allows promoting closures
+/// passed to functions like opApply.
+class EscapeAnalysis {
+  /// Arguments currently being analyzed, each with the function of the
+  /// delegate whose context it is (or null). Recursive calls are assumed not
+  /// to capture; if they did, the capturing instruction would be found anyway
+  /// by the pending analysis of the same argument and delegate function.
+  DenseSet<std::pair<const Argument *, const Function *>> Active;
+
+public:
+  /// Returns whether the pointer V may be captured. If V is the context of the
+  /// delegate Dg, calls through Dg's function pointer are analyzed as calls to
+  /// DgFn.
+  bool mayCapture(Value *V, Value *Dg, Function *DgFn, unsigned Depth);
+
+  /// Returns whether the context of the delegate Dg, whose function is DgFn,
+  /// may be captured.
+  bool delegateMayCapture(Value *Dg, Function *DgFn, unsigned Depth);
+
+  /// Returns whether the callee may capture the pointer passed as argument
+  /// ArgNo, or the context of the delegate passed as argument ArgNo if DgFn
+  /// is set. Callee defaults to the called function.
+  bool argMayBeCaptured(CallSite CS, unsigned ArgNo, Function *Callee,
+                        Function *DgFn, unsigned Depth);
+};
+}
+
+/// If V is inserted as context into a delegate (a pair of pointers) whose
+/// function is known, returns the complete delegate and sets DgFn.
+static Value *getDelegateWithContext(InsertValueInst *IV, Value *V,
+                                     Function *&DgFn) {
+  StructType *DgTy = dyn_cast<StructType>(IV->getType());
+  if (!DgTy || DgTy->getNumElements() != 2 ||
+      !DgTy->getElementType(1)->isPointerTy() ||
+      IV->getInsertedValueOperand() != V || IV->getNumIndices() != 1 ||
+      IV->getIndices()[0] != 0) {
+    return nullptr;
+  }
+
+  // The function pointer is inserted either before or after the context.
+  Value *Dg = nullptr;
+  Value *FnPtr = nullptr;
+  InsertValueInst *Other = dyn_cast<InsertValueInst>(IV->getAggregateOperand());
+  if (Other && Other->getNumIndices() == 1 && Other->getIndices()[0] == 1) {
+    Dg = IV;
+    FnPtr = Other->getInsertedValueOperand();
+  } else if (IV->hasOneUse()) {
+    Other = dyn_cast<InsertValueInst>(*IV->user_begin());
+    if (Other && Other->getAggregateOperand() == IV &&
+        Other->getNumIndices() == 1 && Other->getIndices()[0] == 1) {
+      Dg = Other;
+      FnPtr = Other->getInsertedValueOperand();
+    }
+  }
+  if (!Dg) {
+    return nullptr;
+  }
+
+  DgFn = dyn_cast<Function>(FnPtr->stripPointerCasts());
+  return DgFn ? Dg : nullptr;
+}
+
+/// Returns whether the called value of CS is the function pointer of the
+/// delegate Dg.
+static bool callsDelegate(CallSite CS, Value *Dg) {
+  if (!Dg) {
+    return false;
+  }
+  ExtractValueInst *EVI =
+      dyn_cast<ExtractValueInst>(CS.getCalledValue()->stripPointerCasts());
+  return EVI && EVI->getAggregateOperand() == Dg &&
+         EVI->getNumIndices() == 1 && EVI->getIndices()[0] == 1;
+}
+
+bool EscapeAnalysis::argMayBeCaptured(CallSite CS, unsigned ArgNo,
+                                      Function *Callee, Function *DgFn,
+                                      unsigned Depth) {
+  if (!DgFn && CS.paramHasAttr(ArgNo + 1, LLAttribute::NoCapture)) {
+    return false;
+  }
+
+  if (!Callee) {
+    Callee = CS.getCalledFunction();
+  }
+  // The definition has to be the one used at runtime.
+  if (!Callee || Callee->isDeclaration() ||
+#if LDC_LLVM_VER >= 309
+      Callee->isInterposable() ||
+#else
+      Callee->mayBeOverridden() ||
+#endif
+      Callee->isVarArg() || ArgNo >= Callee->arg_size() || Depth == 0) {
+    return true;
+  }
+
+  auto AI = Callee->arg_begin();
+  std::advance(AI, ArgNo);
+  Argument *Arg = &*AI;
+  if (Arg->getType() != CS.getArgument(ArgNo)->getType()) {
+    return true;
+  }
+
+  const std::pair<const Argument *, const Function *> Key(Arg, DgFn);
+  if (!Active.insert(Key).second) {
+    return false;
+  }
+  bool Captured = DgFn ? delegateMayCapture(Arg, DgFn, Depth - 1)
+                       : mayCapture(Arg, nullptr, nullptr, Depth - 1);
+  Active.erase(Key);
+  return Captured;
+}
+
+bool EscapeAnalysis::delegateMayCapture(Value *Dg, Function *DgFn,
+                                        unsigned Depth) {
+  for (User *U : Dg->users()) {
+    if (ExtractValueInst *EVI = dyn_cast<ExtractValueInst>(U)) {
+      if (EVI->getNumIndices() != 1) {
+        return true;
+      }
+      // The function pointer is harmless, the context is tracked further.
+      if (EVI->getIndices()[0] == 0 && mayCapture(EVI, Dg, DgFn, Depth)) {
+        return true;
+      }
+      continue;
+    }
+
+    CallSite CS(U);
+    if (!CS.getInstruction() || CS.getCalledValue() == Dg) {
+      return true;
+    }
+    for (unsigned i = 0, e = CS.arg_size(); i != e; ++i) {
+      if (CS.getArgument(i) == Dg &&
+          argMayBeCaptured(CS, i, nullptr, DgFn, Depth)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool EscapeAnalysis::mayCapture(Value *V, Value *Dg, Function *DgFn,
+                                unsigned Depth) {
+  SmallVector<Value *, 16> Worklist;
+  SmallPtrSet<Value *, 16> Visited;
+  Worklist.push_back(V);
+  Visited.insert(V);
+
+  while (!Worklist.empty()) {
+    V = Worklist.pop_back_val();
+    for (User *U : V->users()) {
+      Instruction *I = cast<Instruction>(U);
+      switch (I->getOpcode()) {
+      case Instruction::Call:
+      case Instruction::Invoke: {
+        CallSite CS(I);
+        if (CS.onlyReadsMemory() && CS.doesNotThrow() &&
+            I->getType()->isVoidTy()) {
+          break;
+        }
+        Function *Callee = callsDelegate(CS, Dg) ? DgFn : nullptr;
+        for (unsigned i = 0, e = CS.arg_size(); i != e; ++i) {
+          if (CS.getArgument(i) == V &&
+              argMayBeCaptured(CS, i, Callee, nullptr, Depth)) {
+            return true;
+          }
+        }
+        break;
+      }
+      case Instruction::Load:
+      case Instruction::ICmp:
+        break;
+      case Instruction::Store:
+        if (I->getOperand(0) == V) {
+          return true;
+        }
+        break;
+      case Instruction::BitCast:
+      case Instruction::GetElementPtr:
+      case Instruction::PHI:
+      case Instruction::Select:
+#if LDC_LLVM_VER >= 306
+        if (Visited.insert(I).second) {
+#else
+        if (Visited.insert(I)) {
+#endif
+          Worklist.push_back(I);
+        }
+        break;
+      case Instruction::InsertValue: {
+        Function *NewDgFn = nullptr;
+        Value *NewDg =
+            getDelegateWithContext(cast<InsertValueInst>(I), V, NewDgFn);
+        if (!NewDg || delegateMayCapture(NewDg, NewDgFn, Depth)) {
+          return true;
+        }
+        break;
+      }
+      default:
+        // Returned, converted to an integer, ... - captured.
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
 //===----------------------------------------------------------------------===//
 // GarbageCollect2Stack Pass Implementation
 //===----------------------------------------------------------------------===//
@@ -399,6 +663,11 @@ class LLVM_LIBRARY_VISIBILITY GarbageCollect2Stack : public FunctionPass {
   AllocClassFI AllocClass;
   UntypedMemoryFI AllocMemory;
 
+  // The -dgc2stack-report entries for the current module.
+  std::string Report;
+
+  void report(Instruction *Alloc, StringRef Callee, Outcome::Type Result);
+
 public:
   static char ID; // Pass identification
   GarbageCollect2Stack();
@@ -410,6 +679,8 @@ public:
 
   bool runOnFunction(Function &F) override;
 
+  bool doFinalization(Module &M) override;
+
   void getAnalysisUsage(AnalysisUsage &AU) const override {
 #if LDC_LLVM_VER < 307
     AU.addRequired<DataLayoutPass>();
@@ -460,10 +731,134 @@ static void RemoveCall(CallSite CS, const Analysis &A) {
 
 static bool
 isSafeToStackAllocateArray(BasicBlock::iterator Alloc, DominatorTree &DT,
-                           SmallVector<CallInst *, 4> &RemoveTailCallInsts);
+                           EscapeAnalysis &EA,
+                           SmallVector<CallInst *, 4> &RemoveTailCallInsts,
+                           Outcome::Type &Reason);
 static bool
 isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &DT,
-                      SmallVector<CallInst *, 4> &RemoveTailCallInsts);
+                      EscapeAnalysis &EA,
+                      SmallVector<CallInst *, 4> &RemoveTailCallInsts,
+                      Outcome::Type &Reason);
+
+static const char *getOutcomeName(Outcome::Type Result) {
+  switch (Result) {
+  case Outcome::Promoted:
+    return "Promoted";
+  case Outcome::Deleted:
+    return "Deleted";
+  case Outcome::UnknownType:
+    return "UnknownType";
+  case Outcome::SizeLimit:
+    return "SizeLimit";
+  case Outcome::HasDestructor:
+    return "HasDestructor";
+  case Outcome::EscapesViaStore:
+    return "EscapesViaStore";
+  case Outcome::EscapesViaCall:
+    return "EscapesViaCall";
+  case Outcome::EscapesViaReturn:
+    return "EscapesViaReturn";
+  case Outcome::EscapesOther:
+    return "EscapesOther";
+  case Outcome::ReallocHazard:
+    return "ReallocHazard";
+  }
+  llvm_unreachable("Unknown GC allocation outcome.");
+}
+
+static const char *getOutcomeDescription(Outcome::Type Result) {
+  switch (Result) {
+  case Outcome::Promoted:
+    return "promoted to a stack allocation";
+  case Outcome::Deleted:
+    return "result unused, allocation removed";
+  case Outcome::UnknownType:
+    return "allocated type unknown";
+  case Outcome::SizeLimit:
+    return "size not known to be below -dgc2stack-size-limit";
+  case Outcome::HasDestructor:
+    return "class has a destructor or custom deallocator";
+  case Outcome::EscapesViaStore:
+    return "escapes: stored to memory";
+  case Outcome::EscapesViaCall:
+    return "escapes: passed to a function that may capture it";
+  case Outcome::EscapesViaReturn:
+    return "escapes: returned";
+  case Outcome::EscapesOther:
+    return "escapes: used in an unsupported way";
+  case Outcome::ReallocHazard:
+    return "memory from a previous execution of the allocation may still be "
+           "in use (e.g., in a loop)";
+  }
+  llvm_unreachable("Unknown GC allocation outcome.");
+}
+
+static void writeYAMLString(raw_ostream &OS, StringRef Str) {
+  OS << '\'';
+  for (char C : Str) {
+    if (C == '\'') {
+      OS << '\'';
+    }
+    OS << C;
+  }
+  OS << '\'';
+}
+
+/// Appends an entry in the format of LLVM's optimization records to the
+/// report.
+void GarbageCollect2Stack::report(Instruction *Alloc, StringRef Callee,
+                                  Outcome::Type Result) {
+  if (ReportFile.empty()) {
+    return;
+  }
+
+  raw_string_ostream OS(Report);
+  const bool Passed = Result == Outcome::Promoted || Result == Outcome::Deleted;
+  OS << "--- !" << (Passed ? "Passed" : "Missed") << '\n';
+  OS << "Pass:            dgc2stack\n";
+  OS << "Name:            " << getOutcomeName(Result) << '\n';
+#if LDC_LLVM_VER >= 307
+  if (const DILocation *Loc = Alloc->getDebugLoc().get()) {
+    OS << "DebugLoc:        { File: ";
+    writeYAMLString(OS, Loc->getFilename());
+    OS << ", Line: " << Loc->getLine() << ", Column: " << Loc->getColumn()
+       << " }\n";
+  }
+#endif
+  OS << "Function:        ";
+  writeYAMLString(OS, Alloc->getParent()->getParent()->getName());
+  OS << "\nCallee:          " << Callee << '\n';
+  OS << "Reason:          ";
+  writeYAMLString(OS, getOutcomeDescription(Result));
+  OS << "\n...\n";
+}
+
+bool GarbageCollect2Stack::doFinalization(Module &M) {
+  if (ReportFile.empty()) {
+    return false;
+  }
+
+  // The report is shared by all modules and backend threads; it is
+  // overwritten by the first module of the process and appended to by the
+  // others.
+  static std::mutex ReportMutex;
+  static bool FirstReport = true;
+  std::lock_guard<std::mutex> Lock(ReportMutex);
+
+  std::error_code EC;
+  raw_fd_ostream OS(ReportFile, EC,
+                    FirstReport ? sys::fs::F_Text
+                                : sys::fs::F_Text | sys::fs::F_Append);
+  if (EC) {
+    errs() << "Error: cannot write -dgc2stack-report file '" << ReportFile
+           << "': " << EC.message() << '\n';
+  } else {
+    OS << Report;
+  }
+  FirstReport = false;
+  Report.clear();
+  return false;
+}
 
 /// runOnFunction - Top level algorithm.
 ///
@@ -486,6 +881,7 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
   CallGraphNode *CGNode = CG ? (*CG)[&F] : nullptr;
 
   Analysis A = {DL, *M, CG, CGNode};
+  EscapeAnalysis EA;
 
   BasicBlock &Entry = F.getEntryBlock();
 
@@ -521,6 +917,7 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
       if (Inst->use_empty()) {
         Changed = true;
         NumDeleted++;
+        report(Inst, Callee->getName(), Outcome::Deleted);
         RemoveCall(CS, A);
         continue;
       }
@@ -528,22 +925,29 @@ bool GarbageCollect2Stack::runOnFunction(Function &F) {
       DEBUG(errs() << "GarbageCollect2Stack inspecting: " << *Inst);
 
       if (!info->analyze(CS, A)) {
+        report(Inst, Callee->getName(), info->Failure);
         continue;
       }
 
       SmallVector<CallInst *, 4> RemoveTailCallInsts;
+      Outcome::Type Reason = Outcome::EscapesOther;
       if (info->ReturnType == ReturnType::Array) {
-        if (!isSafeToStackAllocateArray(originalI, DT, RemoveTailCallInsts)) {
+        if (!isSafeToStackAllocateArray(originalI, DT, EA, RemoveTailCallInsts,
+                                        Reason)) {
+          report(Inst, Callee->getName(), Reason);
           continue;
         }
       } else {
-        if (!isSafeToStackAllocate(originalI, Inst, DT, RemoveTailCallInsts)) {
+        if (!isSafeToStackAllocate(originalI, Inst, DT, EA, RemoveTailCallInsts,
+                                   Reason)) {
+          report(Inst, Callee->getName(), Reason);
           continue;
         }
       }
 
       // Let's alloca this!
       Changed = true;
+      report(Inst, Callee->getName(), Outcome::Promoted);
 
       // First demote tail calls which use the value so there IR is never
       // in an invalid state.
@@ -595,22 +999,17 @@ Type *Analysis::getTypeFor(Value *typeinfo) const {
   }
 
 #if LDC_LLVM_VER >= 306
-  Value *ti = llvm::MetadataAsValue::get(node->getContext(),
-                                         node->getOperand(TD_TypeInfo));
+  auto ti = mdconst::dyn_extract<GlobalVariable>(node->getOperand(TD_TypeInfo));
+  auto type = mdconst::dyn_extract<Constant>(node->getOperand(TD_Type));
 #else
-  Value *ti = node->getOperand(TD_TypeInfo);
+  auto ti = dyn_cast<GlobalVariable>(node->getOperand(TD_TypeInfo));
+  Value *type = node->getOperand(TD_Type);
 #endif
-  if (!ti || ti->stripPointerCasts() != ti_global) {
+  if (ti != ti_global || !type) {
     return nullptr;
   }
 
-#if LDC_LLVM_VER >= 306
-  return llvm::MetadataAsValue::get(node->getContext(),
-                                    node->getOperand(TD_Type))
-      ->getType();
-#else
-  return node->getOperand(TD_Type)->getType();
-#endif
+  return type->getType();
 }
 
 /// Returns whether Def is used by any instruction that is reachable from Alloc
@@ -759,8 +1158,8 @@ static bool mayBeUsedAfterRealloc(Instruction *Def, BasicBlock::iterator Alloc,
 /// This handles GC calls returning a D array instead of a raw pointer,
 /// see isSafeToStackAllocate() for details.
 bool isSafeToStackAllocateArray(
-    BasicBlock::iterator Alloc, DominatorTree &DT,
-    SmallVector<CallInst *, 4> &RemoveTailCallInsts) {
+    BasicBlock::iterator Alloc, DominatorTree &DT, EscapeAnalysis &EA,
+    SmallVector<CallInst *, 4> &RemoveTailCallInsts, Outcome::Type &Reason) {
   assert(Alloc->getType()->isStructTy() && "Allocated array is not a struct?");
   Value *V = &(*Alloc);
 
@@ -782,7 +1181,8 @@ bool isSafeToStackAllocateArray(
                "First array field not length?");
       } else {
         assert(idx == 1 && "Invalid array struct access.");
-        if (!isSafeToStackAllocate(Alloc, EVI, DT, RemoveTailCallInsts)) {
+        if (!isSafeToStackAllocate(Alloc, EVI, DT, EA, RemoveTailCallInsts,
+                                   Reason)) {
           return false;
         }
       }
@@ -792,6 +1192,8 @@ bool isSafeToStackAllocateArray(
       // We are super conservative here, the only thing we want to be able to
       // handle at this point is extracting len/ptr. More extensive analysis
       // could be added later.
+      Reason = isa<ReturnInst>(User) ? Outcome::EscapesViaReturn
+                                     : Outcome::EscapesOther;
       return false;
     }
   }
@@ -822,7 +1224,9 @@ bool isSafeToStackAllocateArray(
 /// stack. The affected instructions are added to RemoveTailCallInsts. If
 /// the function returns false, these entries are meaningless.
 bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &DT,
-                           SmallVector<CallInst *, 4> &RemoveTailCallInsts) {
+                           EscapeAnalysis &EA,
+                           SmallVector<CallInst *, 4> &RemoveTailCallInsts,
+                           Outcome::Type &Reason) {
   assert(isa<PointerType>(V->getType()) && "Allocated value is not a pointer?");
 
   SmallVector<Use *, 16> Worklist;
@@ -862,8 +1266,11 @@ bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &
       CallSite::arg_iterator B = CS.arg_begin(), E = CS.arg_end();
       for (CallSite::arg_iterator A = B; A != E; ++A) {
         if (A->get() == V) {
-          if (!CS.paramHasAttr(A - B + 1, LLAttribute::NoCapture)) {
-            // The parameter is not marked 'nocapture' - captured.
+          if (EA.argMayBeCaptured(CS, A - B, nullptr, nullptr,
+                                  CallDepthLimit)) {
+            // The parameter is neither marked 'nocapture' nor known not to be
+            // captured by the callee - captured.
+            Reason = Outcome::EscapesViaCall;
             return false;
           }
 
@@ -885,6 +1292,7 @@ bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &
     case Instruction::Store:
       if (V == I->getOperand(0)) {
         // Stored the pointer - it may be captured.
+        Reason = Outcome::EscapesViaStore;
         return false;
       }
       // Storing to the pointee does not cause the pointer to be captured.
@@ -896,6 +1304,7 @@ bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &
       // It's not safe to stack-allocate if this derived pointer is live across
       // the original allocation.
       if (mayBeUsedAfterRealloc(I, Alloc, DT)) {
+        Reason = Outcome::ReallocHazard;
         return false;
       }
 
@@ -912,8 +1321,44 @@ bool isSafeToStackAllocate(BasicBlock::iterator Alloc, Value *V, DominatorTree &
         }
       }
       break;
+    case Instruction::InsertValue: {
+      // Used as the context of a delegate - not captured if the delegate's
+      // function and the functions it is passed to don't capture it.
+      Function *DgFn = nullptr;
+      Value *Dg = getDelegateWithContext(cast<InsertValueInst>(I), V, DgFn);
+      if (!Dg) {
+        Reason = Outcome::EscapesOther;
+        return false;
+      }
+      if (mayBeUsedAfterRealloc(cast<Instruction>(Dg), Alloc, DT)) {
+        Reason = Outcome::ReallocHazard;
+        return false;
+      }
+      if (EA.delegateMayCapture(Dg, DgFn, CallDepthLimit)) {
+        Reason = Outcome::EscapesViaCall;
+        return false;
+      }
+      // Only allow passing the delegate to other functions here, so that no
+      // derived pointers remain to be checked for liveness across the
+      // allocation.
+      for (User *DgUser : Dg->users()) {
+        CallSite DgCS(DgUser);
+        if (!DgCS.getInstruction()) {
+          Reason = Outcome::EscapesOther;
+          return false;
+        }
+        if (DgCS.isCall() && cast<CallInst>(DgUser)->isTailCall()) {
+          RemoveTailCallInsts.push_back(cast<CallInst>(DgUser));
+        }
+      }
+      break;
+    }
+    case Instruction::Ret:
+      Reason = Outcome::EscapesViaReturn;
+      return false;
     default:
       // Something else - be conservative and say it is captured.
+      Reason = Outcome::EscapesOther;
       return false;
     }
   }
@@ -13,6 +13,7 @@
 #include "gen/abi.h"
 #include "gen/attributes.h"
 #include "gen/functions.h"
+#include "gen/gcprofiling.h"
 #include "gen/irstate.h"
 #include "gen/llvm.h"
 #include "gen/llvmhelpers.h"
@@ -715,6 +716,13 @@ static void buildRuntimeModule() {
                   {stringTy, sizeTy->arrayOf(), uintTy->arrayOf(), ubyteTy});
   }
 
+  // extern (C) void _d_gcprof_register(const(GCProfSite)* sites,
+  //                                    GCProfCounter* counters, size_t length)
+  if (isProfilingGCAllocations()) {
+    createFwdDecl(LINKc, voidTy, {"_d_gcprof_register"},
+                  {voidPtrTy, voidPtrTy, sizeTy});
+  }
+
   if (global.params.hasObjectiveC) {
     assert(global.params.targetTriple->isOSDarwin());
 
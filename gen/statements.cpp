@@ -29,7 +29,9 @@
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InlineAsm.h"
 #include <fstream>
+#include <map>
 #include <math.h>
+#include <set>
 #include <stdio.h>
 
 // Need to include this after the other DMD includes because of missing
@@ -84,6 +86,162 @@ static LLValue *call_string_switch_runtime(llvm::Value *table, Expression *e) {
 
 //////////////////////////////////////////////////////////////////////////////
 
+namespace {
+/// String switches with more cases are dispatched by the druntime
+/// _d_switch_* functions (binary search) instead of an inline decision tree,
+/// to bound the code size.
+const size_t maxInlineStringSwitchCases = 256;
+
+/// Emits the inline dispatch of a string switch, computing the index of the
+/// matching case (or -1) like the _d_switch_* druntime functions.
+///
+/// The cases are first told apart by their length, then recursively by the
+/// character at the position with the most distinct values among the
+/// remaining candidates. The single remaining candidate is confirmed with a
+/// memcmp, unless all of its characters have been checked on the way.
+class StringSwitchDispatcher {
+  struct Candidate {
+    StringExp *str;
+    unsigned index;
+  };
+  using Candidates = llvm::SmallVector<Candidate, 4>;
+
+  IRState &irs;
+  LLValue *ptr;
+  LLType *charType;
+  unsigned charSize;
+  llvm::BasicBlock *resultbb;
+  llvm::SmallVector<std::pair<LLValue *, llvm::BasicBlock *>, 16> results;
+
+public:
+  /// Returns true if the (sorted) cases can be dispatched inline for a
+  /// condition with `charSize` bytes per code unit.
+  static bool isApplicable(CaseStatements *cases, unsigned charSize) {
+    if (cases->dim > maxInlineStringSwitchCases)
+      return false;
+    for (auto cs : *cases) {
+      if (cs->exp->op != TOKstring ||
+          static_cast<StringExp *>(cs->exp)->sz != charSize)
+        return false;
+    }
+    return true;
+  }
+
+  StringSwitchDispatcher(IRState &irs, LLType *charType, unsigned charSize)
+      : irs(irs), ptr(nullptr), charType(charType), charSize(charSize),
+        resultbb(nullptr) {}
+
+  /// Emits the dispatch for the value of `condition`, returning the i32 index
+  /// of the matching case in `cases`, or -1.
+  LLValue *emit(CaseStatements *cases, Expression *condition) {
+    DValue *cond = toElemDtor(condition);
+    LLValue *len = DtoArrayLen(cond);
+    ptr = DtoArrayPtr(cond);
+
+    resultbb = irs.insertBB("stringswitch.result");
+
+    // Group the candidates by length.
+    std::map<size_t, Candidates> byLength;
+    for (unsigned i = 0; i < cases->dim; ++i) {
+      auto str = static_cast<StringExp *>((*cases)[i]->exp);
+      byLength[str->numberOfCodeUnits()].push_back({str, i});
+    }
+
+    auto si = llvm::SwitchInst::Create(len, resultbb, byLength.size(),
+                                       irs.scopebb());
+    results.push_back({DtoConstInt(-1), irs.scopebb()});
+    for (auto &group : byLength) {
+      auto bb = irs.insertBBBefore(resultbb, "stringswitch.length");
+      si->addCase(DtoConstSize_t(group.first), bb);
+      irs.scope() = IRScope(bb);
+      llvm::SmallVector<bool, 16> checked(group.first, false);
+      emitCharDispatch(group.second, checked);
+    }
+
+    irs.scope() = IRScope(resultbb);
+    auto phi = llvm::PHINode::Create(LLType::getInt32Ty(irs.context()),
+                                     results.size(), "stringswitch.index",
+                                     resultbb);
+    for (auto &result : results) {
+      phi->addIncoming(result.first, result.second);
+    }
+    return phi;
+  }
+
+private:
+  void addResult(LLValue *index) {
+    results.push_back({index, irs.scopebb()});
+    llvm::BranchInst::Create(resultbb, irs.scopebb());
+  }
+
+  void emitCharDispatch(Candidates &candidates,
+                        llvm::SmallVectorImpl<bool> &checked) {
+    if (candidates.size() == 1) {
+      emitConfirm(candidates[0], checked);
+      return;
+    }
+
+    // Find the position telling most candidates apart. As all candidates have
+    // the same length and are distinct, there is one with >= 2 values.
+    const size_t length = checked.size();
+    size_t bestPos = 0;
+    size_t bestCount = 0;
+    for (size_t pos = 0; pos < length; ++pos) {
+      if (checked[pos])
+        continue;
+      std::set<unsigned> values;
+      for (auto &c : candidates) {
+        values.insert(c.str->charAt(pos));
+      }
+      if (values.size() > bestCount) {
+        bestPos = pos;
+        bestCount = values.size();
+      }
+    }
+    assert(bestCount > 1);
+
+    std::map<unsigned, Candidates> byChar;
+    for (auto &c : candidates) {
+      byChar[c.str->charAt(bestPos)].push_back(c);
+    }
+
+    LLValue *charVal = DtoLoad(DtoGEPi1(ptr, bestPos), "stringswitch.char");
+    auto si = llvm::SwitchInst::Create(charVal, resultbb, byChar.size(),
+                                       irs.scopebb());
+    results.push_back({DtoConstInt(-1), irs.scopebb()});
+
+    checked[bestPos] = true;
+    for (auto &group : byChar) {
+      auto bb = irs.insertBBBefore(resultbb, "stringswitch.char");
+      si->addCase(
+          llvm::ConstantInt::get(llvm::cast<llvm::IntegerType>(charType),
+                                 group.first),
+          bb);
+      irs.scope() = IRScope(bb);
+      emitCharDispatch(group.second, checked);
+    }
+    checked[bestPos] = false;
+  }
+
+  void emitConfirm(const Candidate &candidate,
+                   llvm::ArrayRef<bool> checked) {
+    LLValue *index = DtoConstUint(candidate.index);
+    if (std::all_of(checked.begin(), checked.end(), [](bool b) { return b; })) {
+      addResult(index);
+      return;
+    }
+
+    auto slice = toConstElem(candidate.str, &irs);
+    LLValue *cmp = DtoMemCmp(ptr, slice->getAggregateElement(1u),
+                             DtoConstSize_t(checked.size() * charSize));
+    LLValue *match = irs.ir->CreateICmpEQ(cmp, DtoConstInt(0));
+    addResult(irs.ir->CreateSelect(match, index, DtoConstInt(-1)));
+  }
+};
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 class ToIRVisitor : public Visitor {
   IRState *irs;
 
@@ -870,9 +1028,11 @@ public:
     indices.reserve(caseCount);
     bool useSwitchInst = true;
 
-    // For string switches, sort the cases and emit the table data.
+    // For string switches, sort the cases and emit the table data (unless
+    // they are dispatched inline).
     llvm::Value *stringTableSlice = nullptr;
     const bool isStringSwitch = !stmt->condition->type->isintegral();
+    bool isInlineStringSwitch = false;
     if (isStringSwitch) {
       Logger::println("is string switch");
 
@@ -880,12 +1040,22 @@ public:
       cases = cases->copy();
       std::sort(cases->begin(), cases->end(), compareCaseStrings);
 
+      for (size_t i = 0; i < caseCount; ++i) {
+        indices.push_back(DtoConstUint(i));
+      }
+
+      const auto charSize =
+          stmt->condition->type->toBasetype()->nextOf()->toBasetype()->size();
+      isInlineStringSwitch =
+          StringSwitchDispatcher::isApplicable(cases, charSize);
+    }
+
+    if (isStringSwitch && !isInlineStringSwitch) {
       // Emit constants for the case values.
       llvm::SmallVector<llvm::Constant *, 16> stringConsts;
       stringConsts.reserve(caseCount);
       for (size_t i = 0; i < caseCount; ++i) {
         stringConsts.push_back(toConstElem((*cases)[i]->exp, irs));
-        indices.push_back(DtoConstUint(i));
       }
 
       // Create internal global with the data table.
@@ -901,7 +1071,7 @@ public:
           llvm::ConstantExpr::getBitCast(arr, getPtrToType(elemTy));
       const auto arrLen = DtoConstSize_t(stringConsts.size());
       stringTableSlice = DtoConstSlice(arrLen, arrPtr);
-    } else {
+    } else if (!isStringSwitch) {
       for (auto cs : *cases) {
         if (cs->exp->op == TOKvar) {
           const auto vd =
@@ -946,7 +1116,13 @@ public:
     if (useSwitchInst) {
       // The case index value.
       LLValue *condVal;
-      if (isStringSwitch) {
+      if (isInlineStringSwitch) {
+        Type *charType =
+            stmt->condition->type->toBasetype()->nextOf()->toBasetype();
+        StringSwitchDispatcher dispatcher(*irs, DtoType(charType),
+                                          charType->size());
+        condVal = dispatcher.emit(cases, stmt->condition);
+      } else if (isStringSwitch) {
         condVal = call_string_switch_runtime(stringTableSlice, stmt->condition);
       } else {
         condVal = DtoRVal(toElemDtor(stmt->condition));
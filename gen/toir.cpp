@@ -2473,9 +2473,41 @@ public:
       slice = DtoConstSlice(DtoConstSize_t(e->keys->dim), slice);
       LLValue *valuesArray = DtoAggrPaint(slice, funcTy->getParamType(2));
 
-      LLValue *aa = gIR->CreateCallOrInvoke(func, aaTypeInfo, keysArray,
-                                            valuesArray, "aa")
-                        .getInstruction();
+      LLValue *aa;
+      if (e->type->isImmutable() || e->type->isConst()) {
+        // The literal can't be modified through its (only) reference, so it's
+        // only constructed on first use (per thread) and reused afterwards.
+        LLType *aaTy = funcTy->getReturnType();
+        auto cache = new LLGlobalVariable(
+            gIR->module, aaTy, false, LLGlobalValue::InternalLinkage,
+            LLConstant::getNullValue(aaTy), ".aaLiteralCache", nullptr,
+            getThreadLocalMode());
+
+        LLValue *cached = DtoLoad(cache, "aa.cached");
+        llvm::BasicBlock *initbb = p->insertBB("aa.init");
+        llvm::BasicBlock *endbb = p->insertBBAfter(initbb, "aa.initend");
+        llvm::BasicBlock *const entrybb = p->scopebb();
+        llvm::BranchInst::Create(initbb, endbb, p->ir->CreateIsNull(cached),
+                                 entrybb);
+
+        p->scope() = IRScope(initbb);
+        LLValue *newAA = gIR->CreateCallOrInvoke(func, aaTypeInfo, keysArray,
+                                                 valuesArray, "aa")
+                             .getInstruction();
+        DtoStore(newAA, cache);
+        llvm::BasicBlock *const initEndbb = p->scopebb();
+        llvm::BranchInst::Create(endbb, initEndbb);
+
+        p->scope() = IRScope(endbb);
+        auto phi = p->ir->CreatePHI(aaTy, 2, "aa");
+        phi->addIncoming(cached, entrybb);
+        phi->addIncoming(newAA, initEndbb);
+        aa = phi;
+      } else {
+        aa = gIR->CreateCallOrInvoke(func, aaTypeInfo, keysArray, valuesArray,
+                                     "aa")
+                 .getInstruction();
+      }
       if (basetype->ty != Taarray) {
         LLValue *tmp = DtoAlloca(e->type, "aaliteral");
         DtoStore(aa, DtoGEPi(tmp, 0, 0));
@@ -8,8 +8,13 @@
 //===----------------------------------------------------------------------===//
 
 #include "gen/llvm.h"
+#include "aggregate.h"
+#include "declaration.h"
 #include "gen/logger.h"
+#include "ir/iraggr.h"
 #include "ir/irdsymbol.h"
+#include "ir/irfunction.h"
+#include "ir/irmodule.h"
 #include "ir/irvar.h"
 
 // Callbacks for constructing/destructing Dsymbol.ir member.
@@ -31,14 +36,9 @@ IrDsymbol::IrDsymbol() : irData(nullptr) {
   list.push_back(this);
 }
 
-IrDsymbol::IrDsymbol(const IrDsymbol &s) {
-  list.push_back(this);
-  irData = s.irData;
-  m_type = s.m_type;
-  m_state = s.m_state;
-}
-
 IrDsymbol::~IrDsymbol() {
+  reset();
+
   if (this == list.back()) {
     list.pop_back();
     return;
@@ -50,6 +50,34 @@ IrDsymbol::~IrDsymbol() {
 }
 
 void IrDsymbol::reset() {
+  // The codegen state refers to the LLVM module it was created for, so it is
+  // freed before the next module is generated.
+  switch (m_type) {
+  case NotSet:
+    break;
+  case ModuleType:
+    delete irModule;
+    break;
+  case AggrType:
+    delete irAggr;
+    break;
+  case FuncType:
+    delete irFunc;
+    break;
+  case GlobalType:
+    delete irGlobal;
+    break;
+  case LocalType:
+    delete irLocal;
+    break;
+  case ParamterType:
+    delete irParam;
+    break;
+  case FieldType:
+    delete irField;
+    break;
+  }
+
   irData = nullptr;
   m_type = Type::NotSet;
   m_state = State::Initial;
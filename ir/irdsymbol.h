@@ -54,7 +54,7 @@ struct IrDsymbol {
   // overload all of these to make sure
   // the static list is up to date
   IrDsymbol();
-  IrDsymbol(const IrDsymbol &s);
+  IrDsymbol(const IrDsymbol &s) = delete; // owns the codegen state
   ~IrDsymbol();
 
   void reset();